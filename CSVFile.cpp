@@ -33,312 +33,3776 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <float.h>
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define CSV_POSIX
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#ifdef CSV_ZLIB
+	#include <zlib.h>
+#endif
+#ifdef CSV_STATS
+	#include <chrono>
+#endif
+#ifdef CSV_ZSTD
+	#include <zstd.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	#define CSV_X86
+	#include <immintrin.h>
+#endif
 
 #include "CSVFile.h"
 
 /*****************************************************************************/
-CSVFile::CSVFile(const char * filename) :
-	file(NULL), path(NULL),
-	ramFile(NULL), ramFileLen(0),
-	rows(NULL), comments(NULL),
-	separator(';'), rem('#'), substitute(':'),
-	noRows(0), noAllocatedRows(0),
-	noColumns(0), noAllocatedColumns(0),
-	noComments(0), noAllocatedComments(0)
+/* Cell or comment string, stored in the arena or viewed in the file */
+struct CSVCell {
+	const char * data;
+	int length;
+	bool view;
+};
+
+/* Arena block, strings are bump-allocated and released in bulk */
+struct CSVBlock {
+	CSVBlock * next;
+	size_t size;
+	size_t used;
+	char data[1];
+};
+
+/* Column of the columnar store, null terminated cells one after the other */
+struct CSVColumn {
+	long long * offsets;
+	char * bytes;
+};
+
+/* Lazy rows: line of each row, and a LRU cache of parsed rows */
+struct CSVLazyRow {
+	int row;
+	int prev, next;
+	char * line;
+	int capacity;
+	CSVCell * cells;
+};
+
+struct CSVLazy {
+	long long * lines;
+	int * slots;
+	CSVLazyRow * cache;
+	int noSlots;
+	int noUsed;
+	int first, last;
+};
+
+/* Read ahead state, shared by the parser and the I/O thread */
+struct CSVPipeline {
+	std::mutex lock;
+	std::condition_variable ready;
+	long long loaded;
+	bool done;
+	bool stop;
+	CSV_ERRORS error;
+};
+
+/* Row filter, testing one field of each line */
+struct CSVFilter {
+	int type;
+	int column;
+	char * text;
+	int length;
+	double min, max;
+	CSVFieldFilter test;
+	void * user;
+};
+
+static const size_t blockSize = 256 * 1024;
+
+static char * arenaString(CSVBlock * & arena, const char * data, int length)
+{
+// Bump-allocate in the current block
+	size_t size = length + 1;
+	CSVBlock * block = arena;
+	if (!block || block->used + size > block->size) {
+	// Open a new block (large strings get a block of their own)
+		size_t len = size > blockSize / 4 ? size : blockSize;
+		block = (CSVBlock *) malloc(sizeof(CSVBlock) + len);
+		if (!block) return NULL;
+		block->size = len;
+		block->used = 0;
+		if (arena && len != blockSize) {
+			block->next = arena->next;
+			arena->next = block;
+		}else{
+			block->next = arena;
+			arena = block;
+		}
+	}
+
+// Copy the string
+	char * ns = &block->data[block->used];
+	block->used += size;
+	memcpy(ns, data, length);
+	ns[length] = 0;
+	return ns;
+}
+
+static void arenaSplice(CSVBlock * & arena, CSVBlock * blocks)
+{
+// Insert blocks behind the current block
+	if (!blocks) return;
+	if (!arena) {
+		arena = blocks;
+		return;
+	}
+	CSVBlock * last = blocks;
+	while (last->next) last = last->next;
+	last->next = arena->next;
+	arena->next = blocks;
+}
+
+static size_t arenaBytes(const CSVBlock * arena)
+{
+	size_t bytes = 0;
+	for (; arena; arena = arena->next)
+		bytes += sizeof(CSVBlock) + arena->size;
+	return bytes;
+}
+
+static void arenaRelease(CSVBlock * & arena)
+{
+	while (arena) {
+		CSVBlock * next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
+
+/*****************************************************************************/
+/* Instrumentation, compiled out unless CSV_STATS is defined */
+#ifdef CSV_STATS
+static double profileClock()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline double profileTotal(const CSVProfile & profile)
+{
+	return profile.loadTime + profile.assessTime + profile.parseTime + profile.materializeTime + profile.writeTime;
+}
+
+/* Phase timer: adds its time, less the phases nested in it, to one field */
+struct CSVPhase {
+	CSVPhase(CSVProfile & profile, double & time) :
+		profile(profile), time(time), start(profileClock()), nested(profileTotal(profile)) {}
+	~CSVPhase() {
+		double elapsed = profileClock() - start;
+		time += elapsed - (profileTotal(profile) - nested);
+	}
+	CSVProfile & profile;
+	double & time;
+	double start;
+	double nested;
+};
+
+static void profileBlocks(CSVProfile & profile, const CSVBlock * blocks)
+{
+	for (; blocks; blocks = blocks->next) {
+		profile.noAllocations++;
+		profile.allocatedBytes += sizeof(CSVBlock) + blocks->size;
+	}
+}
+
+	#define CSV_PHASE(field) CSVPhase phase(profile, profile.field)
+	#define CSV_COUNT(field, count) (profile.field += (count))
+	#define CSV_ALLOC(bytes) (profile.noAllocations++, profile.allocatedBytes += (bytes))
+	#define CSV_BLOCKS(blocks) profileBlocks(profile, blocks)
+	#define CSV_PEAK(bytes) (profile.peakBuffer = (bytes) > profile.peakBuffer ? (bytes) : profile.peakBuffer)
+#else
+	#define CSV_PHASE(field)
+	#define CSV_COUNT(field, count)
+	#define CSV_ALLOC(bytes)
+	#define CSV_BLOCKS(blocks)
+	#define CSV_PEAK(bytes)
+#endif
+
+/*****************************************************************************/
+/* Range of lines parsed by one worker */
+struct CSVChunk {
+	long long start;
+	long long end;
+	int row;
+	int comment;
+	int noRows;
+	int noColumns;
+	int noComments;
+	int noLineChars;
+	int * widths;
+	int noWidths;
+	int maxFields;
+	int noMaxFieldRows;
+	long long noFilledCells;
+	CSVBlock * arena;
+	CSV_ERRORS error;
+};
+
+static const long long minChunkLen = 1 << 20;
+
+template <typename Job>
+static void runParallel(int noJobs, Job job)
+{
+// Run the first job on the calling thread
+	std::thread * workers = new std::thread[noJobs];
+	for (int i = 1; i < noJobs; i++)
+		workers[i] = std::thread(job, i);
+	job(0);
+	for (int i = 1; i < noJobs; i++)
+		workers[i].join();
+	delete [] workers;
+}
+
+static void releaseFile(char * data, long long length, bool mapped)
+{
+	if (!data) return;
+#ifdef CSV_POSIX
+	if (mapped) munmap(data, length);
+	else free(data);
+#else
+	free(data);
+#endif
+}
+
+static CSV_ERRORS mapPath(const char * path, char * & data, long long & length, bool & mapped)
+{
+#ifdef CSV_POSIX
+// Open the file
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return CSV_FILEERROR;
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return CSV_FILEERROR;
+	}
+
+// Map the complete file (empty files can not be mapped)
+	if (st.st_size) {
+		void * p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return CSV_MEMORYERROR;
+		}
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+		data = (char *) p;
+		length = st.st_size;
+		mapped = true;
+	}
+
+// The mapping outlives the descriptor
+	close(fd);
+	return CSV_NOERROR;
+#else
+// Load the complete file instead
+	FILE * in = fopen(path, "rb");
+	if (!in) return CSV_FILEERROR;
+	fseek(in, 0, SEEK_END);
+	long long len = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	data = (char *) malloc(len ? len : 1);
+	bool valid = data && (!len || fread(data, len, 1, in) == 1);
+	fclose(in);
+	if (!valid) {
+		free(data);
+		data = NULL;
+		return CSV_FILEERROR;
+	}
+	length = len;
+	mapped = false;
+	return CSV_NOERROR;
+#endif
+}
+
+/*****************************************************************************/
+/* Frozen strings and file buffer, shared by the clones of a table.
+   The file buffer is the root freeze. Each freeze of strings links to the
+   previous one, still referenced by its cells, until the live strings are
+   compacted into a freeze linked to the root only */
+struct CSVStorage {
+	std::atomic<int> references;
+	CSVBlock * arena;
+	char * file;
+	long long fileLen;
+	bool fileMapped;
+	size_t frozenBytes;
+	size_t liveBytes;
+	CSVStorage * parent;
+};
+
+/* Row and comment tables, shared by the clones until one of them writes */
+struct CSVTables {
+	std::atomic<int> references;
+	CSVCell * matrix;
+	CSVCell * comments;
+	int noAllocatedRows;
+	int noAllocatedColumns;
+	int noAllocatedComments;
+};
+
+static void storageRelease(CSVStorage * & storage)
+{
+// Release the freezes no longer referenced, newest first
+	CSVStorage * s = storage;
+	while (s && s->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		CSVStorage * parent = s->parent;
+		arenaRelease(s->arena);
+		releaseFile(s->file, s->fileLen, s->fileMapped);
+		delete s;
+		s = parent;
+	}
+	storage = NULL;
+}
+
+static void tablesRelease(CSVTables * & tables)
+{
+	if (tables->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		free(tables->matrix);
+		free(tables->comments);
+		delete tables;
+	}
+	tables = NULL;
+}
+
+/* Published versions: readers announce the epoch they entered in,
+   retired versions are freed once every reader has left older epochs */
+static const int maxReaders = 64;
+
+struct CSVReaderSlot {
+	std::atomic<long long> epoch;
+	std::atomic<bool> claimed;
+	char padding[64 - sizeof(std::atomic<long long>) - sizeof(std::atomic<bool>)];
+};
+
+struct CSVRetired {
+	CSVFile * version;
+	long long epoch;
+};
+
+struct CSVPublisher {
+	std::atomic<CSVFile *> current;
+	std::atomic<long long> epoch;
+	CSVReaderSlot slots[maxReaders];
+	CSVRetired * retired;
+	int noRetired, noAllocatedRetired;
+};
+
+/*****************************************************************************/
+/* Delimiter scanning kernels: list the offsets of '\r', '\n', separator,
+   comment and quote characters found in a block */
+typedef int (* CSVScanner)(const char * data, int length, char separator, char rem, char quote, int * positions);
+
+static const int scanBlock = 16384;
+
+static int scanScalar(const char * data, int length, char separator, char rem, char quote, int * positions)
+{
+	int count = 0;
+	for (int k = 0; k < length; k++) {
+		char c = data[k];
+		if (c == '\r' || c == '\n' || c == separator || c == rem || c == quote)
+			positions[count++] = k;
+	}
+	return count;
+}
+
+#ifdef CSV_X86
+static inline int emitPositions(unsigned int mask, int base, int * positions, int count)
+{
+// Turn each set bit into an offset
+	while (mask) {
+		positions[count++] = base + __builtin_ctz(mask);
+		mask &= mask - 1;
+	}
+	return count;
+}
+
+__attribute__((target("sse2")))
+static int scanSSE2(const char * data, int length, char separator, char rem, char quote, int * positions)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i sp = _mm_set1_epi8(separator);
+	const __m128i rm = _mm_set1_epi8(rem);
+	const __m128i qt = _mm_set1_epi8(quote);
+	int count = 0;
+	int k = 0;
+	for (; k + 16 <= length; k += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &data[k]);
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)),
+								 _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, rm)));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, qt));
+		count = emitPositions(_mm_movemask_epi8(m), k, positions, count);
+	}
+	int tail = scanScalar(&data[k], length - k, separator, rem, quote, &positions[count]);
+	for (int i = count; i < count + tail; i++) positions[i] += k;
+	return count + tail;
+}
+
+__attribute__((target("avx2")))
+static int scanAVX2(const char * data, int length, char separator, char rem, char quote, int * positions)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i sp = _mm256_set1_epi8(separator);
+	const __m256i rm = _mm256_set1_epi8(rem);
+	const __m256i qt = _mm256_set1_epi8(quote);
+	int count = 0;
+	int k = 0;
+	for (; k + 32 <= length; k += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) &data[k]);
+		__m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)),
+									_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, rm)));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, qt));
+		count = emitPositions((unsigned int) _mm256_movemask_epi8(m), k, positions, count);
+	}
+	int tail = scanSSE2(&data[k], length - k, separator, rem, quote, &positions[count]);
+	for (int i = count; i < count + tail; i++) positions[i] += k;
+	return count + tail;
+}
+#endif
+
+static int bestKernel(int kernel)
+{
+// Fall back to the best kernel supported by the processor
+#ifdef CSV_X86
+	__builtin_cpu_init();
+	if (kernel == CSV_KERNEL_AUTO || kernel >= CSV_KERNEL_AVX2) {
+		if (__builtin_cpu_supports("avx2")) return CSV_KERNEL_AVX2;
+		kernel = CSV_KERNEL_SSE2;
+	}
+	if (kernel == CSV_KERNEL_SSE2 && __builtin_cpu_supports("sse2"))
+		return CSV_KERNEL_SSE2;
+#endif
+	return CSV_KERNEL_SCALAR;
+}
+
+static CSVScanner selectScanner(int kernel)
+{
+#ifdef CSV_X86
+	switch (bestKernel(kernel)) {
+		case CSV_KERNEL_AVX2: return scanAVX2;
+		case CSV_KERNEL_SSE2: return scanSSE2;
+	}
+#endif
+	return scanScalar;
+}
+
+/*****************************************************************************/
+/* Classification kernels: bit masks of the line ends, separators, comment
+   characters, blanks and quotes of a 64 bytes block */
+typedef void (* CSVMasker)(const char * data, char separator, char rem, char quote, unsigned long long * masks);
+
+static void maskScalar(const char * data, char separator, char rem, char quote, unsigned long long * masks)
+{
+	masks[0] = masks[1] = masks[2] = masks[3] = masks[4] = 0;
+	for (int k = 0; k < 64; k++) {
+		char c = data[k];
+		unsigned long long bit = 1ULL << k;
+		if (c == '\r' || c == '\n') masks[0] |= bit;
+		if (c == separator) masks[1] |= bit;
+		if (c == rem) masks[2] |= bit;
+		if (c == ' ' || c == '\t') masks[3] |= bit;
+		if (c == quote && quote) masks[4] |= bit;
+	}
+}
+
+#ifdef CSV_X86
+__attribute__((target("sse2")))
+static void maskSSE2(const char * data, char separator, char rem, char quote, unsigned long long * masks)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i sp = _mm_set1_epi8(separator);
+	const __m128i rm = _mm_set1_epi8(rem);
+	const __m128i bl = _mm_set1_epi8(' ');
+	const __m128i tb = _mm_set1_epi8('\t');
+	const __m128i qt = _mm_set1_epi8(quote);
+	masks[0] = masks[1] = masks[2] = masks[3] = masks[4] = 0;
+	for (int k = 0; k < 64; k += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) &data[k]);
+		masks[0] |= (unsigned long long) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))) << k;
+		masks[1] |= (unsigned long long) _mm_movemask_epi8(_mm_cmpeq_epi8(v, sp)) << k;
+		masks[2] |= (unsigned long long) _mm_movemask_epi8(_mm_cmpeq_epi8(v, rm)) << k;
+		masks[3] |= (unsigned long long) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, bl), _mm_cmpeq_epi8(v, tb))) << k;
+		if (quote) masks[4] |= (unsigned long long) _mm_movemask_epi8(_mm_cmpeq_epi8(v, qt)) << k;
+	}
+}
+
+__attribute__((target("avx2")))
+static void maskAVX2(const char * data, char separator, char rem, char quote, unsigned long long * masks)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i sp = _mm256_set1_epi8(separator);
+	const __m256i rm = _mm256_set1_epi8(rem);
+	const __m256i bl = _mm256_set1_epi8(' ');
+	const __m256i tb = _mm256_set1_epi8('\t');
+	const __m256i qt = _mm256_set1_epi8(quote);
+	masks[0] = masks[1] = masks[2] = masks[3] = masks[4] = 0;
+	for (int k = 0; k < 64; k += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) &data[k]);
+		masks[0] |= (unsigned long long) (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf))) << k;
+		masks[1] |= (unsigned long long) (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, sp)) << k;
+		masks[2] |= (unsigned long long) (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, rm)) << k;
+		masks[3] |= (unsigned long long) (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, bl), _mm256_cmpeq_epi8(v, tb))) << k;
+		if (quote) masks[4] |= (unsigned long long) (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, qt)) << k;
+	}
+}
+#endif
+
+static CSVMasker selectMasker(int kernel)
+{
+#ifdef CSV_X86
+	switch (bestKernel(kernel)) {
+		case CSV_KERNEL_AVX2: return maskAVX2;
+		case CSV_KERNEL_SSE2: return maskSSE2;
+	}
+#endif
+	return maskScalar;
+}
+
+static inline unsigned long long prefixXor(unsigned long long bits)
+{
+// Each bit becomes the parity of the bits up to it: the spans between quotes
+	bits ^= bits << 1;
+	bits ^= bits << 2;
+	bits ^= bits << 4;
+	bits ^= bits << 8;
+	bits ^= bits << 16;
+	bits ^= bits << 32;
+	return bits;
+}
+
+static long long quoteScan(const char * data, long long start, long long end, char rem, char quote, CSVMasker masker, bool & inQuote, bool & inComment, bool first)
+{
+// Follow the quotes and comments as the splitter does, 64 bytes at a time
+// Return the end of the last (or first) line closed outside quotes, -1 if none
+	long long lineEnd = -1;
+	for (long long base = start; base < end; base += 64) {
+		unsigned long long masks[5];
+		long long left = end - base;
+		if (left >= 64) masker(&data[base], '\n', rem, quote, masks);
+		else{
+			char tail[64];
+			memset(tail, 0, 64);
+			memcpy(tail, &data[base], left);
+			masker(tail, '\n', rem, quote, masks);
+			unsigned long long valid = (1ULL << left) - 1;
+			for (int m = 0; m < 5; m++) masks[m] &= valid;
+		}
+		unsigned long long from = ~0ULL;
+		while (from) {
+		// Line ends end comments, line ends and comments count outside quotes
+			unsigned long long events = masks[0] & from;
+			if (!inComment) {
+				unsigned long long quotes = masks[4] & from;
+				unsigned long long inside = prefixXor(quotes);
+				if (inQuote) inside = ~inside;
+				events = (masks[0] | masks[2]) & from & ~inside;
+				if (!events) inQuote ^= __builtin_popcountll(quotes) & 1;
+			}
+			if (!events) break;
+			unsigned long long mark = events & (0 - events);
+			from = ~(mark | (mark - 1));
+			inQuote = false;
+			inComment = !(masks[0] & mark);
+			if (inComment) continue;
+			lineEnd = base + __builtin_ctzll(mark) + 1;
+			if (first) return lineEnd;
+		}
+	}
+	return lineEnd;
+}
+
+/*****************************************************************************/
+/* Splits a buffer into lines of fields, one delimiter block at a time
+   Quotes hide the delimiters they enclose, a doubled quote within quotes
+   stands for a quote. Fields made of one quoted span are views of their
+   content, others are unescaped when the line closes: in place if the
+   buffer is writable and split once, into a scratch buffer otherwise */
+struct CSVSplitter {
+	CSVSplitter(const char * data, long long length, char separator, char rem, char quote, int kernel, bool inPlace = false);
+	~CSVSplitter();
+	void reset(const char * data, long long length);
+	bool split();
+	bool unescape();
+	bool scratched(const CSVView & field) {return scratch && field.data >= scratch && field.data < scratch + scratchSize;}
+
+	const char * data;
+	long long length;
+	char separator;
+	char rem;
+	char quote;
+	bool inPlace;
+	CSVScanner scanner;
+
+	int * positions;
+	int noPositions;
+	int position;
+	long long blockStart;
+	long long blockEnd;
+
+	CSVView * fields;
+	int noFields;
+	int noAllocatedFields;
+	int * escaped;
+	int noEscaped;
+	int noAllocatedEscaped;
+	char * scratch;
+	int scratchSize;
+	CSVView comment;
+	bool commentOnLine;
+	bool rowLine;
+	long long lineStart;
+	CSV_ERRORS error;
+};
+
+CSVSplitter::CSVSplitter(const char * data, long long length, char separator, char rem, char quote, int kernel, bool inPlace) :
+	data(data), length(length),
+	separator(separator), rem(rem), quote(quote),
+	inPlace(inPlace),
+	scanner(selectScanner(kernel)),
+	noPositions(0), position(0),
+	blockStart(0), blockEnd(0),
+	noFields(0), noAllocatedFields(64),
+	escaped(NULL), noEscaped(0), noAllocatedEscaped(0),
+	scratch(NULL), scratchSize(0),
+	commentOnLine(false), rowLine(false), lineStart(0),
+	error(CSV_NOERROR)
+{
+	comment.data = NULL;
+	comment.length = 0;
+	positions = (int *) malloc(sizeof(int) * scanBlock);
+	fields = (CSVView *) malloc(sizeof(CSVView) * noAllocatedFields);
+	if (!positions || !fields) error = CSV_MEMORYERROR;
+}
+
+CSVSplitter::~CSVSplitter()
+{
+	if (positions) free(positions);
+	if (fields) free(fields);
+	if (escaped) free(escaped);
+	if (scratch) free(scratch);
+}
+
+void CSVSplitter::reset(const char * data, long long length)
+{
+// Split another buffer with the same settings
+	this->data = data;
+	this->length = length;
+	noPositions = 0;
+	position = 0;
+	blockStart = 0;
+	blockEnd = 0;
+	lineStart = 0;
+}
+
+static inline bool hasContent(const char * data, int length)
+{
+	for (int k = 0; k < length; k++)
+		if (data[k] != ' ' && data[k] != '\t') return true;
+	return false;
+}
+
+bool CSVSplitter::split()
+{
+// Start a new line
+	if (error) return false;
+	noFields = 0;
+	noEscaped = 0;
+	commentOnLine = false;
+	comment.data = NULL;
+	comment.length = 0;
+	long long fieldStart = lineStart;
+	long long commentStart = 0;
+	bool inQuote = false;
+	bool firstContent = false;
+	int noQuotes = 0;
+
+	while (1) {
+	// Scan the next block for delimiters
+		if (position == noPositions) {
+			if (blockEnd >= length) break;
+			blockStart = blockEnd;
+			blockEnd = length - blockStart < scanBlock ? length : blockStart + scanBlock;
+			noPositions = scanner(&data[blockStart], (int) (blockEnd - blockStart), separator, rem, quote ? quote : '\r', positions);
+			position = 0;
+			continue;
+		}
+		long long k = blockStart + positions[position++];
+		int c = data[k];
+
+	// Quotes toggle the quoted state outside comments
+		if (c == quote) {
+			if (commentOnLine) continue;
+			inQuote = !inQuote;
+			noQuotes++;
+			continue;
+		}
+		if (inQuote) continue;
+		bool newLine = (c == '\r' || c == '\n');
+		if (!newLine && commentOnLine) continue;
+
+	// Close the current field
+		if (!commentOnLine) {
+			if (noFields == noAllocatedFields) {
+				noAllocatedFields *= 2;
+				CSVView * nf = (CSVView *) realloc(fields, sizeof(CSVView) * noAllocatedFields);
+				if (!nf) {error = CSV_MEMORYERROR; return false;}
+				fields = nf;
+			}
+			CSVView & field = fields[noFields];
+			field.data = &data[fieldStart];
+			field.length = (int) (k - fieldStart);
+			if (!noFields) firstContent = noQuotes || hasContent(field.data, field.length);
+			if (noQuotes == 2 && field.data[0] == quote && field.data[field.length - 1] == quote) {
+			// A single quoted span: view its content
+				field.data++;
+				field.length -= 2;
+			}else if (noQuotes) {
+			// Unescape the field when the line closes
+				if (noEscaped == noAllocatedEscaped) {
+					noAllocatedEscaped = noAllocatedEscaped ? noAllocatedEscaped * 2 : 16;
+					int * ne = (int *) realloc(escaped, sizeof(int) * noAllocatedEscaped);
+					if (!ne) {error = CSV_MEMORYERROR; return false;}
+					escaped = ne;
+				}
+				escaped[noEscaped++] = noFields;
+			}
+			noQuotes = 0;
+			noFields++;
+			fieldStart = k + 1;
+			if (c == rem) {
+				commentOnLine = true;
+				commentStart = k + 1;
+			}
+			if (!newLine) continue;
+		}
+
+	// Close the line, lines of a single blank or empty field are not rows
+		if (commentOnLine) {
+			comment.data = &data[commentStart];
+			comment.length = (int) (k - commentStart);
+		}
+		rowLine = noFields > 1 || firstContent;
+		if (noEscaped && !unescape()) return false;
+		lineStart = k + 1;
+		return true;
+	}
+
+// The last line is not terminated
+	return false;
+}
+
+static int unquote(const char * data, int length, char quote, char * out)
+{
+// Copy the runs between quotes, a doubled quote within quotes is one quote
+	const char * end = &data[length];
+	bool inQuote = false;
+	int n = 0;
+	while (data < end) {
+		const char * q = (const char *) memchr(data, quote, end - data);
+		int run = (int) ((q ? q : end) - data);
+		memmove(&out[n], data, run);
+		n += run;
+		if (!q) break;
+		data = q + 1;
+		if (inQuote && data < end && *data == quote) {
+			out[n++] = quote;
+			data++;
+		}else inQuote = !inQuote;
+	}
+	return n;
+}
+
+bool CSVSplitter::unescape()
+{
+// Size the scratch buffer for the line
+	if (!inPlace) {
+		int total = 0;
+		for (int e = 0; e < noEscaped; e++)
+			total += fields[escaped[e]].length;
+		if (total > scratchSize) {
+			char * ns = (char *) realloc(scratch, total);
+			if (!ns) {error = CSV_MEMORYERROR; return false;}
+			scratch = ns;
+			scratchSize = total;
+		}
+	}
+
+// Unescape the fields, they only shrink
+	char * out = scratch;
+	for (int e = 0; e < noEscaped; e++) {
+		CSVView & field = fields[escaped[e]];
+		char * to = inPlace ? (char *) field.data : out;
+		field.length = unquote(field.data, field.length, quote, to);
+		field.data = to;
+		if (!inPlace) out += field.length;
+	}
+	return true;
+}
+
+/*****************************************************************************/
+/* Output buffer flushed to the file in large blocks */
+enum {CSV_CODEC_NONE, CSV_CODEC_GZIP, CSV_CODEC_ZSTD};
+enum {CSV_PACK_CONTINUE, CSV_PACK_FLUSH, CSV_PACK_END};
+
+static int pathCodec(const char * path)
+{
+// Compressed output is chosen by the file extension
+	size_t len = strlen(path);
+	if (len > 3 && !strcmp(&path[len - 3], ".gz")) return CSV_CODEC_GZIP;
+	if (len > 4 && !strcmp(&path[len - 4], ".zst")) return CSV_CODEC_ZSTD;
+	return CSV_CODEC_NONE;
+}
+
+struct CSVWriter {
+	CSVWriter();
+	~CSVWriter();
+	CSV_ERRORS open(const char * path, int bufferSize, bool direct, bool append, int workers = 0);
+	CSV_ERRORS flush(bool all);
+	CSV_ERRORS close();
+	void put(const char * data, int length);
+	CSV_ERRORS emit(const char * data, int length);
+	CSV_ERRORS pack(int mode);
+
+	char * buffer;
+	int size;
+	int used;
+	bool direct;
+	CSV_ERRORS error;
+	int codec;
+	char * packed;
+#ifdef CSV_STATS
+	long long written;
+#endif
+#ifdef CSV_ZLIB
+	z_stream zs;
+#endif
+#ifdef CSV_ZSTD
+	ZSTD_CCtx * zcs;
+#endif
+#ifdef CSV_POSIX
+	int fd;
+#else
+	FILE * file;
+#endif
+};
+
+static const int directAlign = 4096;
+
+CSVWriter::CSVWriter() :
+	buffer(NULL), size(0), used(0),
+	direct(false), error(CSV_NOERROR),
+	codec(CSV_CODEC_NONE), packed(NULL),
+#ifdef CSV_STATS
+	written(0),
+#endif
+#ifdef CSV_ZSTD
+	zcs(NULL),
+#endif
+#ifdef CSV_POSIX
+	fd(-1)
+#else
+	file(NULL)
+#endif
+{
+}
+
+CSVWriter::~CSVWriter()
+{
+	close();
+}
+
+CSV_ERRORS CSVWriter::open(const char * path, int bufferSize, bool direct, bool append, int workers)
+{
+// Allocate the buffer (aligned blocks for direct I/O)
+	codec = pathCodec(path);
+	this->direct = direct && !append && !codec;
+	size = (bufferSize + directAlign - 1) / directAlign * directAlign;
+	if (size < directAlign) size = directAlign;
+#ifdef CSV_POSIX
+	if (this->direct) {
+		void * p = NULL;
+		if (posix_memalign(&p, directAlign, size)) p = NULL;
+		buffer = (char *) p;
+	}else buffer = (char *) malloc(size);
+#else
+	this->direct = false;
+	buffer = (char *) malloc(size);
+#endif
+	if (!buffer) return error = CSV_MEMORYERROR;
+	used = 0;
+
+// Start the compressor
+	if (codec) {
+		packed = (char *) malloc(size);
+		if (!packed) return error = CSV_MEMORYERROR;
+		bool started = false;
+#ifdef CSV_ZLIB
+		if (codec == CSV_CODEC_GZIP) {
+			memset(&zs, 0, sizeof(z_stream));
+			started = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+			if (!started) error = CSV_MEMORYERROR;
+		}
+#endif
+#ifdef CSV_ZSTD
+		if (codec == CSV_CODEC_ZSTD) {
+			zcs = ZSTD_createCCtx();
+			started = zcs != NULL;
+			if (!started) error = CSV_MEMORYERROR;
+			else if (workers > 1) ZSTD_CCtx_setParameter(zcs, ZSTD_c_nbWorkers, workers);
+		}
+#endif
+		if (!started) {
+		// Not built with this compressor
+			free(packed);
+			packed = NULL;
+			return error = error ? error : CSV_FORMATERROR;
+		}
+	}
+
+// Open the CSV file
+#ifdef CSV_POSIX
+	int mode = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+#ifdef O_DIRECT
+	if (this->direct) fd = ::open(path, mode | O_DIRECT, 0666);
+#endif
+	if (fd < 0) {
+		this->direct = false;
+		fd = ::open(path, mode, 0666);
+	}
+	if (fd < 0) return error = CSV_FILEERROR;
+#else
+	file = fopen(path, append ? "ab" : "wb");
+	if (!file) return error = CSV_FILEERROR;
+	setvbuf(file, NULL, _IONBF, 0);
+#endif
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVWriter::flush(bool all)
+{
+// Direct I/O only takes whole blocks, until the last one
+	if (error) return error;
+	if (codec) return pack(all ? CSV_PACK_FLUSH : CSV_PACK_CONTINUE);
+	int len = used;
+	if (direct && !all) len -= len % directAlign;
+#if defined(CSV_POSIX) && defined(O_DIRECT)
+	if (direct && len % directAlign) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		direct = false;
+	}
+#endif
+
+// Write the blocks
+	if (emit(buffer, len)) return error;
+	memmove(buffer, &buffer[len], used - len);
+	used -= len;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVWriter::emit(const char * data, int length)
+{
+// Write the bytes, retrying on interruptions
+	int done = 0;
+	while (done < length) {
+#ifdef CSV_POSIX
+		ssize_t n = ::write(fd, &data[done], length - done);
+		if (n < 0 && errno == EINTR) continue;
+#ifdef O_DIRECT
+		if (n < 0 && errno == EINVAL && direct) {
+		// The file system refused direct I/O
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+			direct = false;
+			continue;
+		}
+#endif
+#else
+		long n = (long) fwrite(&data[done], 1, length - done, file);
+		if (!n) n = -1;
+#endif
+		if (n < 0) return error = CSV_FILEERROR;
+		done += (int) n;
+	}
+#ifdef CSV_STATS
+	written += length;
+#endif
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVWriter::pack(int mode)
+{
+// Compress the buffer, write the compressed blocks
+	if (error) return error;
+#ifdef CSV_ZLIB
+	if (codec == CSV_CODEC_GZIP) {
+		int flush = mode == CSV_PACK_END ? Z_FINISH : mode == CSV_PACK_FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+		zs.next_in = (Bytef *) buffer;
+		zs.avail_in = used;
+		do {
+			zs.next_out = (Bytef *) packed;
+			zs.avail_out = size;
+			if (deflate(&zs, flush) == Z_STREAM_ERROR) return error = CSV_MEMORYERROR;
+			if (emit(packed, size - zs.avail_out)) return error;
+		} while (!zs.avail_out);
+	}
+#endif
+#ifdef CSV_ZSTD
+	if (codec == CSV_CODEC_ZSTD) {
+		ZSTD_EndDirective directive = mode == CSV_PACK_END ? ZSTD_e_end : mode == CSV_PACK_FLUSH ? ZSTD_e_flush : ZSTD_e_continue;
+		ZSTD_inBuffer in = {buffer, (size_t) used, 0};
+		size_t left;
+		do {
+			ZSTD_outBuffer out = {packed, (size_t) size, 0};
+			left = ZSTD_compressStream2(zcs, &out, &in, directive);
+			if (ZSTD_isError(left)) return error = CSV_MEMORYERROR;
+			if (emit(packed, (int) out.pos)) return error;
+		} while (directive == ZSTD_e_continue ? in.pos < in.size : left != 0);
+	}
+#endif
+	used = 0;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVWriter::close()
+{
+	if (!buffer) return error;
+	if (codec) pack(CSV_PACK_END);
+	else flush(true);
+#ifdef CSV_POSIX
+	if (fd >= 0 && ::close(fd) && !error) error = CSV_FILEERROR;
+	fd = -1;
+#else
+	if (file && fclose(file) && !error) error = CSV_FILEERROR;
+	file = NULL;
+#endif
+	free(buffer);
+	buffer = NULL;
+
+// Release the compressor
+	if (packed) {
+#ifdef CSV_ZLIB
+		if (codec == CSV_CODEC_GZIP) deflateEnd(&zs);
+#endif
+#ifdef CSV_ZSTD
+		if (codec == CSV_CODEC_ZSTD) ZSTD_freeCCtx(zcs);
+		zcs = NULL;
+#endif
+		free(packed);
+		packed = NULL;
+	}
+	return error;
+}
+
+inline void CSVWriter::put(const char * data, int length)
+{
+	while (1) {
+	// Copy as much as possible
+		int len = size - used < length ? size - used : length;
+		memcpy(&buffer[used], data, len);
+		used += len;
+		if (len == length) return;
+		data += len;
+		length -= len;
+
+	// Flush the full buffer
+		if (flush(false)) return;
+	}
+}
+
+/*****************************************************************************/
+/* File reader, decoding compressed files block by block */
+struct CSVReader {
+	CSVReader();
+	~CSVReader();
+	CSV_ERRORS open(const char * path);
+	long long read(char * data, long long length);
+	long long consumed();
+	size_t refill();
+	void close();
+
+	FILE * file;
+	int codec;
+	bool end;
+	CSV_ERRORS error;
+	unsigned char * input;
+	long long total;
+#ifdef CSV_ZLIB
+	z_stream zs;
+#endif
+#ifdef CSV_ZSTD
+	ZSTD_DStream * zds;
+	ZSTD_inBuffer zin;
+	bool frameEnd;
+#endif
+};
+
+static const int readerBlock = 1 << 16;
+
+CSVReader::CSVReader() :
+	file(NULL), codec(CSV_CODEC_NONE), end(false), error(CSV_NOERROR),
+	input(NULL), total(0)
+#ifdef CSV_ZSTD
+	, zds(NULL)
+#endif
+{
+}
+
+CSVReader::~CSVReader()
+{
+	close();
+}
+
+CSV_ERRORS CSVReader::open(const char * path)
+{
+// Open the file, recognise the compressed ones
+	file = fopen(path, "rb");
+	if (!file) return error = CSV_FILEERROR;
+	unsigned char magic[4];
+	size_t n = fread(magic, 1, 4, file);
+	fseek(file, 0, SEEK_SET);
+	if (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) codec = CSV_CODEC_GZIP;
+	else if (n == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) codec = CSV_CODEC_ZSTD;
+	if (!codec) return CSV_NOERROR;
+
+// Start the decompressor
+	input = (unsigned char *) malloc(readerBlock);
+	if (!input) return error = CSV_MEMORYERROR;
+#ifdef CSV_ZLIB
+	if (codec == CSV_CODEC_GZIP) {
+		memset(&zs, 0, sizeof(z_stream));
+		if (inflateInit2(&zs, 15 + 16) != Z_OK) return error = CSV_MEMORYERROR;
+		return CSV_NOERROR;
+	}
+#endif
+#ifdef CSV_ZSTD
+	if (codec == CSV_CODEC_ZSTD) {
+		zds = ZSTD_createDStream();
+		if (!zds) return error = CSV_MEMORYERROR;
+		ZSTD_initDStream(zds);
+		zin.src = input;
+		zin.size = 0;
+		zin.pos = 0;
+		frameEnd = false;
+		return CSV_NOERROR;
+	}
+#endif
+// Not built with this decompressor
+	free(input);
+	input = NULL;
+	return error = CSV_FORMATERROR;
+}
+
+size_t CSVReader::refill()
+{
+	size_t n = fread(input, 1, readerBlock, file);
+	if (ferror(file)) error = CSV_FILEERROR;
+	total += n;
+#ifdef CSV_ZLIB
+	zs.next_in = input;
+	zs.avail_in = (uInt) n;
+#endif
+#ifdef CSV_ZSTD
+	zin.size = n;
+	zin.pos = 0;
+#endif
+	return n;
+}
+
+long long CSVReader::read(char * data, long long length)
+{
+// Plain files are read as is
+	if (error || end) return 0;
+	if (!codec) {
+		long long n = (long long) fread(data, 1, length, file);
+		if (ferror(file)) error = CSV_FILEERROR;
+		end = n < length;
+		total += n;
+		return n;
+	}
+	long long done = 0;
+#ifdef CSV_ZLIB
+	while (codec == CSV_CODEC_GZIP && done < length && !end && !error) {
+	// Decode the next bytes
+		bool eof = !zs.avail_in && !refill();
+		if (error) break;
+		uInt room = length - done < (1 << 30) ? (uInt) (length - done) : (1 << 30);
+		zs.next_out = (Bytef *) &data[done];
+		zs.avail_out = room;
+		int r = inflate(&zs, Z_NO_FLUSH);
+		done += room - zs.avail_out;
+		if (r == Z_STREAM_END) {
+		// Another member may follow
+			if (!zs.avail_in && !refill()) end = true;
+			else inflateReset(&zs);
+		}else if (r != Z_OK && !(r == Z_BUF_ERROR && !eof)) error = CSV_FORMATERROR;
+	}
+#endif
+#ifdef CSV_ZSTD
+	while (codec == CSV_CODEC_ZSTD && done < length && !end && !error) {
+	// Decode the next bytes, frames follow each other
+		bool eof = zin.pos == zin.size && !refill();
+		if (error) break;
+		ZSTD_outBuffer out = {&data[done], (size_t) (length - done), 0};
+		size_t pos = zin.pos;
+		size_t r = ZSTD_decompressStream(zds, &out, &zin);
+		if (ZSTD_isError(r)) {error = CSV_FORMATERROR; break;}
+		if (out.pos || zin.pos != pos) frameEnd = !r;
+		done += out.pos;
+		if (eof && !out.pos) {
+		// Truncated files end inside a frame
+			if (!frameEnd) error = CSV_FORMATERROR;
+			end = true;
+		}
+	}
+#endif
+	return done;
+}
+
+long long CSVReader::consumed()
+{
+// Bytes of the file used so far
+#ifdef CSV_ZLIB
+	if (codec == CSV_CODEC_GZIP) return total - zs.avail_in;
+#endif
+#ifdef CSV_ZSTD
+	if (codec == CSV_CODEC_ZSTD) return total - (long long) (zin.size - zin.pos);
+#endif
+	return total;
+}
+
+void CSVReader::close()
+{
+	if (input) {
+#ifdef CSV_ZLIB
+		if (codec == CSV_CODEC_GZIP) inflateEnd(&zs);
+#endif
+#ifdef CSV_ZSTD
+		if (codec == CSV_CODEC_ZSTD) ZSTD_freeDStream(zds);
+		zds = NULL;
+#endif
+		free(input);
+		input = NULL;
+	}
+	if (file) fclose(file);
+	file = NULL;
+}
+
+/*****************************************************************************/
+/* Numbers: exact fast paths, falling back on the C library */
+static const double powers10[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const unsigned long long maxExact = 1ULL << 53;
+
+static bool parseInt64(const char * data, int length, long long & value)
+{
+// Skip blanks
+	const char * end = data + length;
+	while (data < end && (*data == ' ' || *data == '\t')) data++;
+	while (end > data && (end[-1] == ' ' || end[-1] == '\t')) end--;
+	if (data == end) return false;
+
+// Read the sign and the digits
+	bool negative = *data == '-';
+	if (*data == '-' || *data == '+') data++;
+	if (data == end) return false;
+	unsigned long long v = 0;
+	unsigned long long limit = negative ? 9223372036854775808ULL : 9223372036854775807ULL;
+	for (; data < end; data++) {
+		unsigned int d = (unsigned char) *data - '0';
+		if (d > 9) return false;
+		if (v > (limit - d) / 10) return false;
+		v = v * 10 + d;
+	}
+	value = negative ? (long long) (0 - v) : (long long) v;
+	return true;
+}
+
+static bool parseDouble(const char * data, int length, bool terminated, double & value)
+{
+// Skip blanks
+	const char * end = data + length;
+	while (data < end && (*data == ' ' || *data == '\t')) data++;
+	while (end > data && (end[-1] == ' ' || end[-1] == '\t')) end--;
+	if (data == end) return false;
+
+// Read a plain decimal: [sign] digits [. digits] [e [sign] digits]
+	const char * p = data;
+	bool negative = *p == '-';
+	if (*p == '-' || *p == '+') p++;
+	unsigned long long mantissa = 0;
+	int exponent = 0, digits = 0;
+	bool exact = true;
+	for (; p < end && (unsigned int) (*p - '0') <= 9; p++, digits++) {
+		if (mantissa >= maxExact / 10) exact = false;
+		else mantissa = mantissa * 10 + (*p - '0');
+		if (!exact) exponent++;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && (unsigned int) (*p - '0') <= 9; p++, digits++) {
+			if (mantissa >= maxExact / 10) exact = false;
+			if (!exact) continue;
+			mantissa = mantissa * 10 + (*p - '0');
+			exponent--;
+		}
+	}
+	if (digits && p < end && (*p == 'e' || *p == 'E')) {
+		const char * q = p + 1;
+		bool negativeExp = q < end && *q == '-';
+		if (q < end && (*q == '-' || *q == '+')) q++;
+		int e = 0;
+		for (; q < end && (unsigned int) (*q - '0') <= 9 && e < 10000; q++)
+			e = e * 10 + (*q - '0');
+		if (q > p + 1 && (unsigned int) (q[-1] - '0') <= 9) {
+			exponent += negativeExp ? -e : e;
+			p = q;
+		}
+	}
+
+// Clinger's fast path: mantissa and power of ten are exact doubles, so a
+// single correctly rounded operation gives the correctly rounded result
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+	if (digits && p == end && exact && exponent >= -22 && exponent <= 22) {
+		double v = (double) mantissa;
+		v = exponent < 0 ? v / powers10[-exponent] : v * powers10[exponent];
+		value = negative ? -v : v;
+		return true;
+	}
+#endif
+
+// Convert a null terminated copy
+	char local[64];
+	char * copy = local;
+	length = (int) (end - data);
+	if (!terminated || *end) {
+		if (length >= (int) sizeof(local)) copy = (char *) malloc(length + 1);
+		if (!copy) return false;
+		memcpy(copy, data, length);
+		copy[length] = 0;
+	}else copy = (char *) data;
+	char * stop;
+	double v = strtod(copy, &stop);
+	bool valid = stop == copy + length;
+	if (valid) value = v;
+	if (copy != local && copy != data) free(copy);
+	return valid;
+}
+
+static int formatInt64(char * buffer, long long value)
+{
+// Write the digits backwards, then in order
+	char digits[20];
+	int n = 0, len = 0;
+	unsigned long long v = value < 0 ? 0 - (unsigned long long) value : value;
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	}while (v);
+	if (value < 0) buffer[len++] = '-';
+	while (n) buffer[len++] = digits[--n];
+	buffer[len] = 0;
+	return len;
+}
+
+static int formatDouble(char * buffer, double value)
+{
+// Find the fewest decimals k such that m / 10^k converts back to the value
+	double a = value < 0 ? -value : value;
+	if (a >= 1e-4 && a < (double) maxExact) {
+		for (int k = 0; k <= 22; k++) {
+			double scaled = a * powers10[k];
+			if (scaled >= (double) maxExact) break;
+			unsigned long long m = (unsigned long long) (scaled + 0.5);
+			if ((double) m / powers10[k] != a) continue;
+		// Write m with a decimal point k digits from the right
+			char digits[20];
+			int n = 0, len = 0;
+			do {
+				digits[n++] = '0' + m % 10;
+				m /= 10;
+			}while (m);
+			if (value < 0) buffer[len++] = '-';
+			if (n <= k) {
+				buffer[len++] = '0';
+				buffer[len++] = '.';
+				for (int z = n; z < k; z++) buffer[len++] = '0';
+			}
+			while (n) {
+				if (n == k && len && buffer[len - 1] != '.') buffer[len++] = '.';
+				buffer[len++] = digits[--n];
+			}
+			buffer[len] = 0;
+			return len;
+		}
+	}else if (a == 0.0 && !signbit(value)) {
+		buffer[0] = '0';
+		buffer[1] = 0;
+		return 1;
+	}
+
+// Fewest significant digits that round-trip, 17 always do
+	int len = 0;
+	for (int precision = 1; precision <= 17; precision++) {
+		len = snprintf(buffer, 32, "%.*g", precision, value);
+		if (value != value || strtod(buffer, NULL) == value) break;
+	}
+	return len;
+}
+
+/*****************************************************************************/
+CSVFile::CSVFile(const char * filename) :
+	file(NULL), path(NULL),
+	ramFile(NULL), ramFileLen(0), ramFileMapped(false),
+	contentFile(NULL), contentFileLen(0), contentFileMapped(false),
+	matrix(NULL), comments(NULL), arena(NULL),
+	columns(NULL), noStoredColumns(0),
+	separator(';'), rem('#'), quote(0), substitute(':'),
+	flags(CSV_DEFAULT), kernel(CSV_KERNEL_AUTO), threads(0),
+	writeBufferSize(0), sink(NULL), sinkColumns(0),
+	projection(NULL), projectionNames(NULL), noProjected(0),
+	filter(NULL), lazy(NULL), lazyCacheRows(1024), statWidths(NULL), pipelineBlockSize(1 << 22),
+	noRows(0), noAllocatedRows(0),
+	noColumns(0), noAllocatedColumns(0),
+	noComments(0), noAllocatedComments(0),
+	storage(NULL), tables(NULL), publisher(NULL), cloneError(CSV_NOERROR)
+{
+	memset(&profile, 0, sizeof(CSVProfile));
+	setEOL("\r\n");
+	if (!filename) return;
+	path = strdup(filename);
+}
+
+CSVFile::CSVFile(int noRows, int noColumns, int noComments) :
+	file(NULL), path(NULL),
+	ramFile(NULL), ramFileLen(0), ramFileMapped(false),
+	contentFile(NULL), contentFileLen(0), contentFileMapped(false),
+	matrix(NULL), comments(NULL), arena(NULL),
+	columns(NULL), noStoredColumns(0),
+	separator(';'), rem('#'), quote(0), substitute(':'),
+	flags(CSV_DEFAULT), kernel(CSV_KERNEL_AUTO), threads(0),
+	writeBufferSize(0), sink(NULL), sinkColumns(0),
+	projection(NULL), projectionNames(NULL), noProjected(0),
+	filter(NULL), lazy(NULL), lazyCacheRows(1024), statWidths(NULL), pipelineBlockSize(1 << 22),
+	noRows(0), noAllocatedRows(0),
+	noColumns(0), noAllocatedColumns(0),
+	noComments(0), noAllocatedComments(0),
+	storage(NULL), tables(NULL), publisher(NULL), cloneError(CSV_NOERROR)
+{
+// Pre-allocate memory
+	memset(&profile, 0, sizeof(CSVProfile));
+	reallocate(noRows, noColumns, noComments);
+	setEOL("\r\n");
+}
+
+CSVFile::CSVFile(const CSVFile & source) :
+	CSVFile((const char *) NULL)
+{
+// Copy the settings
+	const CSVFile & from = source;
+	if (from.path) path = strdup(from.path);
+	separator = from.separator;
+	rem = from.rem;
+	quote = from.quote;
+	substitute = from.substitute;
+	memcpy(eol, from.eol, sizeof(eol));
+	eolLen = from.eolLen;
+	flags = from.flags;
+	kernel = from.kernel;
+	threads = from.threads;
+	writeBufferSize = from.writeBufferSize;
+	lazyCacheRows = from.lazyCacheRows;
+	pipelineBlockSize = from.pipelineBlockSize;
+	if (from.projectionNames) setProjectionNames(from.projectionNames, from.noProjected);
+	else setProjection(from.projection, from.noProjected);
+	if (projection) memcpy(projection, from.projection, sizeof(int) * noProjected);
+	if (from.filter) {
+		filter = (CSVFilter *) malloc(sizeof(CSVFilter));
+		if (filter) {
+			*filter = *from.filter;
+			if (filter->text) filter->text = strdup(filter->text);
+			if (from.filter->text && !filter->text) clearFilter();
+		}
+	}
+
+// Lazy rows keep a cache of their own
+	if (from.lazy) {
+		int count = from.noRows ? from.noRows : 1;
+		lazy = (CSVLazy *) calloc(1, sizeof(CSVLazy));
+		if (!lazy) {
+			cloneError = CSV_MEMORYERROR;
+			return;
+		}
+		lazy->first = -1;
+		lazy->last = -1;
+		lazy->noSlots = from.lazy->noSlots;
+		lazy->lines = (long long *) malloc(sizeof(long long) * 2 * count);
+		lazy->slots = (int *) malloc(sizeof(int) * count);
+		lazy->cache = (CSVLazyRow *) calloc(lazy->noSlots, sizeof(CSVLazyRow));
+		if (!lazy->lines || !lazy->slots || !lazy->cache) {
+			cloneError = CSV_MEMORYERROR;
+			dropLazy();
+			return;
+		}
+		if (from.noRows) memcpy(lazy->lines, from.lazy->lines, sizeof(long long) * 2 * from.noRows);
+		for (int r = 0; r < count; r++) lazy->slots[r] = -1;
+	}
+
+// Share the content, copied on the first write
+	cloneError = const_cast<CSVFile &>(source).lend(*this);
+	if (cloneError) dropLazy();
+}
+
+CSVFile::CSVFile(CSVFile && source) :
+	CSVFile((const char *) NULL)
+{
+	swap(source);
+}
+
+CSVFile & CSVFile::operator=(CSVFile source)
+{
+	swap(source);
+	return *this;
+}
+
+CSVFile::~CSVFile()
+{
+// Release the published versions (readers are gone)
+	if (publisher) {
+		delete publisher->current.load();
+		for (int i = 0; i < publisher->noRetired; i++)
+			delete publisher->retired[i].version;
+		free(publisher->retired);
+		delete publisher;
+	}
+
+// Close file
+	closeAppend();
+	clearProjection();
+	clearFilter();
+	free(statWidths);
+	unload();
+	if (file) fclose(file);
+	if (path) free(path);
+
+// Clean-up content
+	freeContent();
+	if (matrix) free(matrix);
+	if (comments) free(comments);
+}
+
+/*****************************************************************************/
+void CSVFile::swap(CSVFile & other)
+{
+	std::swap(file, other.file);
+	std::swap(path, other.path);
+	std::swap(ramFile, other.ramFile);
+	std::swap(ramFileLen, other.ramFileLen);
+	std::swap(ramFileMapped, other.ramFileMapped);
+	std::swap(contentFile, other.contentFile);
+	std::swap(contentFileLen, other.contentFileLen);
+	std::swap(contentFileMapped, other.contentFileMapped);
+	std::swap(storage, other.storage);
+	std::swap(tables, other.tables);
+	std::swap(publisher, other.publisher);
+	std::swap(matrix, other.matrix);
+	std::swap(comments, other.comments);
+	std::swap(arena, other.arena);
+	std::swap(columns, other.columns);
+	std::swap(noStoredColumns, other.noStoredColumns);
+	std::swap(separator, other.separator);
+	std::swap(rem, other.rem);
+	std::swap(quote, other.quote);
+	std::swap(substitute, other.substitute);
+	std::swap(eol, other.eol);
+	std::swap(eolLen, other.eolLen);
+	std::swap(flags, other.flags);
+	std::swap(kernel, other.kernel);
+	std::swap(threads, other.threads);
+	std::swap(writeBufferSize, other.writeBufferSize);
+	std::swap(sink, other.sink);
+	std::swap(sinkColumns, other.sinkColumns);
+	std::swap(projection, other.projection);
+	std::swap(projectionNames, other.projectionNames);
+	std::swap(noProjected, other.noProjected);
+	std::swap(filter, other.filter);
+	std::swap(lazy, other.lazy);
+	std::swap(lazyCacheRows, other.lazyCacheRows);
+	std::swap(statWidths, other.statWidths);
+	std::swap(pipelineBlockSize, other.pipelineBlockSize);
+	std::swap(noRows, other.noRows);
+	std::swap(noAllocatedRows, other.noAllocatedRows);
+	std::swap(noColumns, other.noColumns);
+	std::swap(noAllocatedColumns, other.noAllocatedColumns);
+	std::swap(noComments, other.noComments);
+	std::swap(noAllocatedComments, other.noAllocatedComments);
+	std::swap(profile, other.profile);
+	std::swap(cloneError, other.cloneError);
+}
+
+static std::mutex cloneLock;
+
+CSV_ERRORS CSVFile::lend(CSVFile & clone)
+{
+// Modifies this file: freezes its content, then shares it with the clone
+// Clones of one file are serialized, writes to it must not race with them
+	std::lock_guard<std::mutex> guard(cloneLock);
+	CSV_ERRORS error = share();
+	if (error) return error;
+	clone.storage = storage;
+	if (storage) storage->references.fetch_add(1, std::memory_order_relaxed);
+	clone.tables = tables;
+	tables->references.fetch_add(1, std::memory_order_relaxed);
+	clone.matrix = matrix;
+	clone.comments = comments;
+	clone.noAllocatedRows = noAllocatedRows;
+	clone.noAllocatedColumns = noAllocatedColumns;
+	clone.noAllocatedComments = noAllocatedComments;
+	clone.contentFile = contentFile;
+	clone.contentFileLen = contentFileLen;
+	clone.contentFileMapped = contentFileMapped;
+	clone.noRows = noRows;
+	clone.noColumns = noColumns;
+	clone.noComments = noComments;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::share()
+{
+	CSV_PHASE(materializeTime);
+	if (!tables) {
+	// Materialize the views of a mapped file, shared tables are never written
+		for (int r = 0; r < noRows && contentFileMapped && !lazy; r++)
+			for (int c = 0; c < noColumns; c++) {
+				CSVCell & cell = tableRow(r)[c];
+				if (!cell.view) continue;
+				char * ns = allocString(cell.data, cell.length);
+				if (!ns) return CSV_MEMORYERROR;
+				cell.data = ns;
+				cell.view = false;
+			}
+		for (int c = 0; c < noComments && contentFileMapped; c++) {
+			CSVCell & cell = comments[c];
+			if (!cell.view) continue;
+			char * ns = allocString(cell.data, cell.length);
+			if (!ns) return CSV_MEMORYERROR;
+			cell.data = ns;
+			cell.view = false;
+		}
+
+	// Copy the live strings out of the chain once it holds twice their size
+		if (arena && storage && !lazy && storage->frozenBytes + arenaBytes(arena) > 2 * storage->liveBytes + blockSize) {
+			CSV_ERRORS error = compact();
+			if (error) return error;
+		}
+
+	// Hand the tables over
+		tables = new CSVTables;
+		tables->references.store(1, std::memory_order_relaxed);
+		tables->matrix = matrix;
+		tables->comments = comments;
+		tables->noAllocatedRows = noAllocatedRows;
+		tables->noAllocatedColumns = noAllocatedColumns;
+		tables->noAllocatedComments = noAllocatedComments;
+	}
+
+// Freeze the file buffer, then the strings written since the last clone
+	if (!storage && contentFile) {
+		storage = new CSVStorage;
+		storage->references.store(1, std::memory_order_relaxed);
+		storage->arena = NULL;
+		storage->file = contentFile;
+		storage->fileLen = contentFileLen;
+		storage->fileMapped = contentFileMapped;
+		storage->frozenBytes = 0;
+		storage->liveBytes = 0;
+		storage->parent = NULL;
+	}
+	if (arena) {
+		CSVStorage * frozen = new CSVStorage;
+		size_t bytes = arenaBytes(arena);
+		frozen->references.store(1, std::memory_order_relaxed);
+		frozen->arena = arena;
+		frozen->file = NULL;
+		frozen->fileLen = 0;
+		frozen->fileMapped = false;
+		frozen->frozenBytes = storage ? storage->frozenBytes + bytes : bytes;
+		frozen->liveBytes = storage && storage->frozenBytes ? storage->liveBytes : bytes;
+		frozen->parent = storage;
+		storage = frozen;
+		arena = NULL;
+	}
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::compact()
+{
+// Copy the strings of the cells and comments, the file buffer stays
+	CSVBlock * fresh = NULL;
+	CSV_ERRORS error = CSV_NOERROR;
+	for (int r = 0; r < noRows && !error; r++)
+		for (int c = 0; c < noColumns; c++) {
+			CSVCell & cell = tableRow(r)[c];
+			if (!cell.data || (cell.data >= contentFile && cell.data < contentFile + contentFileLen)) continue;
+			char * ns = arenaString(fresh, cell.data, cell.length);
+			if (!ns) {error = CSV_MEMORYERROR; break;}
+			cell.data = ns;
+		}
+	for (int c = 0; c < noComments && !error; c++) {
+		CSVCell & cell = comments[c];
+		if (!cell.data || (cell.data >= contentFile && cell.data < contentFile + contentFileLen)) continue;
+		char * ns = arenaString(fresh, cell.data, cell.length);
+		if (!ns) {error = CSV_MEMORYERROR; break;}
+		cell.data = ns;
+	}
+	CSV_BLOCKS(fresh);
+	if (error) {
+	// Keep the strings copied so far, the chain still holds the others
+		arenaSplice(arena, fresh);
+		return error;
+	}
+
+// Drop the older freezes, link the new strings to the file buffer only
+	CSVStorage * root = storage;
+	while (root && root->arena) root = root->parent;
+	if (root) root->references.fetch_add(1, std::memory_order_relaxed);
+	storageRelease(storage);
+	storage = root;
+	arenaRelease(arena);
+	arena = fresh;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::unshare()
+{
+	if (!tables) return CSV_NOERROR;
+// Take the tables back when the clones are gone
+	if (tables->references.load(std::memory_order_acquire) == 1) {
+		delete tables;
+		tables = NULL;
+		return CSV_NOERROR;
+	}
+
+// Copy the tables before the first write
+	size_t size = sizeof(CSVCell) * noAllocatedRows * noAllocatedColumns;
+	CSVCell * nm = (CSVCell *) malloc(size ? size : 1);
+	CSVCell * nc = (CSVCell *) malloc(sizeof(CSVCell) * (noAllocatedComments ? noAllocatedComments : 1));
+	if (!nm || !nc) {
+		free(nm);
+		free(nc);
+		return CSV_MEMORYERROR;
+	}
+	CSV_ALLOC(size);
+	CSV_ALLOC(sizeof(CSVCell) * noAllocatedComments);
+	if (size) memcpy(nm, matrix, size);
+	if (noAllocatedComments) memcpy(nc, comments, sizeof(CSVCell) * noAllocatedComments);
+	tablesRelease(tables);
+	matrix = nm;
+	comments = nc;
+	return CSV_NOERROR;
+}
+
+/*****************************************************************************/
+CSV_ERRORS CSVFile::publish()
+{
+	if (lazy) return CSV_FORMATERROR;
+	if (!publisher) {
+	// Start at epoch 1, readers out of a read are at 0
+		publisher = new CSVPublisher;
+		publisher->current.store(NULL);
+		publisher->epoch.store(1);
+		for (int i = 0; i < maxReaders; i++) {
+			publisher->slots[i].epoch.store(0);
+			publisher->slots[i].claimed.store(false);
+		}
+		publisher->retired = NULL;
+		publisher->noRetired = 0;
+		publisher->noAllocatedRetired = 0;
+	}
+
+// Make room to retire the current version
+	if (publisher->noRetired == publisher->noAllocatedRetired) {
+		int capacity = publisher->noAllocatedRetired ? publisher->noAllocatedRetired * 2 : 8;
+		CSVRetired * nr = (CSVRetired *) realloc(publisher->retired, sizeof(CSVRetired) * capacity);
+		if (!nr) return CSV_MEMORYERROR;
+		publisher->retired = nr;
+		publisher->noAllocatedRetired = capacity;
+	}
+
+// Clone the content, readers never write to it
+	CSV_ERRORS error = share();
+	if (error) return error;
+	CSVFile * version = new CSVFile(*this);
+	error = version->getCloneError();
+	if (!error && (version->flags & CSV_COLUMNAR)) error = version->buildColumns();
+	if (error) {
+		delete version;
+		return error;
+	}
+
+// Swap it in, then close the epoch of the version it replaces
+	CSVFile * old = publisher->current.exchange(version);
+	long long epoch = publisher->epoch.fetch_add(1);
+	if (old) {
+		publisher->retired[publisher->noRetired].version = old;
+		publisher->retired[publisher->noRetired].epoch = epoch;
+		publisher->noRetired++;
+	}
+	reclaim();
+	return CSV_NOERROR;
+}
+
+void CSVFile::reclaim()
+{
+// Find the oldest epoch a reader is still in
+	long long oldest = 0x7FFFFFFFFFFFFFFFLL;
+	for (int i = 0; i < maxReaders; i++) {
+		long long epoch = publisher->slots[i].epoch.load();
+		if (epoch && epoch < oldest) oldest = epoch;
+	}
+
+// Free the versions retired before it
+	int kept = 0;
+	for (int i = 0; i < publisher->noRetired; i++) {
+		if (publisher->retired[i].epoch < oldest) delete publisher->retired[i].version;
+		else publisher->retired[kept++] = publisher->retired[i];
+	}
+	publisher->noRetired = kept;
+}
+
+int CSVFile::registerReader()
+{
+	if (!publisher) return -1;
+	for (int i = 0; i < maxReaders; i++) {
+		bool expected = false;
+		if (publisher->slots[i].claimed.compare_exchange_strong(expected, true)) return i;
+	}
+	return -1;
+}
+
+void CSVFile::unregisterReader(int reader)
+{
+	if (!publisher || reader < 0 || reader >= maxReaders) return;
+	publisher->slots[reader].epoch.store(0);
+	publisher->slots[reader].claimed.store(false);
+}
+
+CSVFile * CSVFile::beginRead(int reader)
+{
+	if (!publisher || reader < 0 || reader >= maxReaders) return NULL;
+// Announce the epoch before loading the version
+	CSVReaderSlot & slot = publisher->slots[reader];
+	slot.epoch.store(publisher->epoch.load());
+	return publisher->current.load();
+}
+
+void CSVFile::endRead(int reader)
+{
+	if (!publisher || reader < 0 || reader >= maxReaders) return;
+	publisher->slots[reader].epoch.store(0, std::memory_order_release);
+}
+
+/*****************************************************************************/
+CSV_ERRORS CSVFile::reallocate(int noRows, int noColumns, int noComments)
+{
+// Grow the capacity (tables shared with clones are copied first)
+	dropColumns();
+	CSV_ERRORS error = reserve(noRows, noColumns, noComments, false);
+	if (error) return error;
+
+// Clear the cells and comments cut off
+	int keptRows = this->noRows < noAllocatedRows ? this->noRows : noAllocatedRows;
+	int keptColumns = this->noColumns < noAllocatedColumns ? this->noColumns : noAllocatedColumns;
+	for (int r = noRows; r < keptRows; r++)
+		memset(tableRow(r), 0, sizeof(CSVCell) * keptColumns);
+	for (int r = 0; r < noRows && r < keptRows && noColumns < keptColumns; r++)
+		memset(&tableRow(r)[noColumns], 0, sizeof(CSVCell) * (keptColumns - noColumns));
+	for (int c = noComments; c < this->noComments; c++)
+		comments[c].data = NULL;
+	this->noRows = noRows;
+	this->noColumns = noColumns;
+	this->noComments = noComments;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::reserve(int noRows, int noColumns, int noComments, bool grow)
+{
+	CSV_ERRORS error = unshare();
+	if (error) return error;
+
+// Size the cell matrix, geometrically when growing (rows are at least one cell wide)
+	int rowCapacity = noAllocatedRows;
+	int columnCapacity = noAllocatedColumns;
+	if (noRows > rowCapacity) {
+		if (grow) {
+			rowCapacity = rowCapacity ? rowCapacity : 64;
+			while (rowCapacity < noRows) rowCapacity *= 2;
+		}else rowCapacity = noRows;
+	}
+	if (noColumns > columnCapacity || (rowCapacity && !columnCapacity)) {
+		if (grow) {
+			columnCapacity = columnCapacity ? columnCapacity : 8;
+			while (columnCapacity < noColumns) columnCapacity *= 2;
+		}else columnCapacity = noColumns > 1 ? noColumns : 1;
+	}
+	if (rowCapacity != noAllocatedRows || columnCapacity != noAllocatedColumns) {
+		CSVCell * nm = (CSVCell *) realloc(matrix, sizeof(CSVCell) * rowCapacity * columnCapacity);
+		if (!nm) return CSV_MEMORYERROR;
+	// Spread the rows to the new width in place, last row first
+		if (columnCapacity != noAllocatedColumns) {
+			for (int r = noAllocatedRows - 1; r >= 0; r--) {
+				memmove(&nm[(size_t) r * columnCapacity], &nm[(size_t) r * noAllocatedColumns], sizeof(CSVCell) * noAllocatedColumns);
+				memset(&nm[(size_t) r * columnCapacity + noAllocatedColumns], 0, sizeof(CSVCell) * (columnCapacity - noAllocatedColumns));
+			}
+		}
+		memset(&nm[(size_t) noAllocatedRows * columnCapacity], 0, sizeof(CSVCell) * (rowCapacity - noAllocatedRows) * columnCapacity);
+		CSV_ALLOC(sizeof(CSVCell) * rowCapacity * columnCapacity);
+		matrix = nm;
+		noAllocatedRows = rowCapacity;
+		noAllocatedColumns = columnCapacity;
+	}
+
+// Size the comments the same way
+	if (noComments > noAllocatedComments) {
+		int capacity = noComments;
+		if (grow) {
+			capacity = noAllocatedComments ? noAllocatedComments : 16;
+			while (capacity < noComments) capacity *= 2;
+		}
+		CSVCell * nc = (CSVCell *) realloc(comments, sizeof(CSVCell) * capacity);
+		if (!nc) return CSV_MEMORYERROR;
+		memset(&nc[noAllocatedComments], 0, sizeof(CSVCell) * (capacity - noAllocatedComments));
+		CSV_ALLOC(sizeof(CSVCell) * capacity);
+		comments = nc;
+		noAllocatedComments = capacity;
+	}
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::addRow()
+{
+	if (lazy) return CSV_FORMATERROR;
+	CSV_ERRORS error = reserve(noRows + 1, noColumns, 0, true);
+	if (error) return error;
+	dropColumns();
+	memset(tableRow(noRows), 0, sizeof(CSVCell) * noAllocatedColumns);
+	noRows++;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::addColumn()
+{
+	if (lazy) return CSV_FORMATERROR;
+	CSV_ERRORS error = reserve(noRows, noColumns + 1, 0, true);
+	if (error) return error;
+	dropColumns();
+	noColumns++;
+	return CSV_NOERROR;
+}
+
+void CSVFile::freeContent()
+{
+// Leave the shared tables to the clones
+	if (tables && tables->references.load(std::memory_order_acquire) > 1) {
+		tablesRelease(tables);
+		matrix = NULL;
+		comments = NULL;
+		noAllocatedRows = 0;
+		noAllocatedColumns = 0;
+		noAllocatedComments = 0;
+	}
+	unshare();
+
+// Clear cells
+	if (matrix) memset(matrix, 0, sizeof(CSVCell) * noAllocatedRows * noAllocatedColumns);
+// Clear comments
+	if (comments) memset(comments, 0, sizeof(CSVCell) * noAllocatedComments);
+// Release all strings at once
+	dropColumns();
+	dropLazy();
+	arenaRelease(arena);
+	if (storage) storageRelease(storage);
+	else releaseFile(contentFile, contentFileLen, contentFileMapped);
+	contentFile = NULL;
+	contentFileLen = 0;
+	contentFileMapped = false;
+}
+
+/*****************************************************************************/
+inline CSVCell * CSVFile::tableRow(int row)
+{
+	return &matrix[(size_t) row * noAllocatedColumns];
+}
+
+inline CSVCell * CSVFile::cellRow(int row)
+{
+	return lazy ? lazyRow(row) : tableRow(row);
+}
+
+CSVCell * CSVFile::lazyRow(int row)
+{
+	int s = lazy->slots[row];
+	if (s >= 0) {
+	// Unlink a cached row
+		CSVLazyRow & slot = lazy->cache[s];
+		if (slot.prev >= 0) lazy->cache[slot.prev].next = slot.next;
+		else lazy->first = slot.next;
+		if (slot.next >= 0) lazy->cache[slot.next].prev = slot.prev;
+		else lazy->last = slot.prev;
+	}else{
+	// Take a free slot, or drop the least recently used row
+		CSV_PHASE(materializeTime);
+		if (lazy->noUsed < lazy->noSlots) {
+			s = lazy->noUsed++;
+			lazy->cache[s].cells = (CSVCell *) calloc(noColumns ? noColumns : 1, sizeof(CSVCell));
+			if (!lazy->cache[s].cells) {
+				lazy->noUsed--;
+				return NULL;
+			}
+		}else{
+			s = lazy->last;
+			lazy->last = lazy->cache[s].prev;
+			if (lazy->last >= 0) lazy->cache[lazy->last].next = -1;
+			else lazy->first = -1;
+			if (lazy->cache[s].row >= 0) lazy->slots[lazy->cache[s].row] = -1;
+		}
+		CSVLazyRow & slot = lazy->cache[s];
+		slot.row = -1;
+		memset(slot.cells, 0, sizeof(CSVCell) * noColumns);
+
+	// Copy the line, terminator included
+		long long start = lazy->lines[row * 2];
+		int length = (int) (lazy->lines[row * 2 + 1] - start);
+		if (length > slot.capacity) {
+			char * nl = (char *) realloc(slot.line, length + 1);
+			if (!nl) {
+			// Give the slot back as the next one to reuse
+				slot.prev = lazy->last;
+				slot.next = -1;
+				if (lazy->last >= 0) lazy->cache[lazy->last].next = s;
+				else lazy->first = s;
+				lazy->last = s;
+				return NULL;
+			}
+			CSV_ALLOC(length + 1);
+			slot.line = nl;
+			slot.capacity = length;
+		}
+		memcpy(slot.line, &contentFile[start], length);
+
+	// Split the line and terminate the fields in place
+		CSVSplitter splitter(slot.line, length, separator, rem, quote, kernel, true);
+		if (splitter.split()) {
+			for (int c = 0; c < noColumns; c++) {
+				int f = projection ? projection[c] : c;
+				if (f < 0 || f >= splitter.noFields || !splitter.fields[f].length) continue;
+				char * data = (char *) splitter.fields[f].data;
+				data[splitter.fields[f].length] = 0;
+				slot.cells[c].data = data;
+				slot.cells[c].length = splitter.fields[f].length;
+			}
+		}
+		slot.row = row;
+		lazy->slots[row] = s;
+	}
+
+// Make it the most recently used row
+	CSVLazyRow & slot = lazy->cache[s];
+	slot.prev = -1;
+	slot.next = lazy->first;
+	if (lazy->first >= 0) lazy->cache[lazy->first].prev = s;
+	lazy->first = s;
+	if (lazy->last < 0) lazy->last = s;
+	return slot.cells;
+}
+
+void CSVFile::dropLazy()
+{
+	if (!lazy) return;
+	for (int s = 0; s < lazy->noUsed; s++) {
+		free(lazy->cache[s].line);
+		free(lazy->cache[s].cells);
+	}
+	free(lazy->cache);
+	free(lazy->slots);
+	free(lazy->lines);
+	free(lazy);
+	lazy = NULL;
+}
+
+/*****************************************************************************/
+CSV_ERRORS CSVFile::buildColumns()
+{
+// Allocate the offsets
+	CSV_PHASE(materializeTime);
+	dropColumns();
+	if (!noColumns) return CSV_NOERROR;
+	columns = (CSVColumn *) calloc(noColumns, sizeof(CSVColumn));
+	if (!columns) return CSV_MEMORYERROR;
+	noStoredColumns = noColumns;
+	for (int c = 0; c < noColumns; c++) {
+		columns[c].offsets = (long long *) malloc(sizeof(long long) * (noRows + 1));
+		if (!columns[c].offsets) {
+			dropColumns();
+			return CSV_MEMORYERROR;
+		}
+		CSV_ALLOC(sizeof(long long) * (noRows + 1));
+		columns[c].offsets[0] = 0;
+	}
+
+// Size the columns, row by row
+	for (int r = 0; r < noRows; r++) {
+		CSVCell * row = cellRow(r);
+		if (!row) {
+			dropColumns();
+			return CSV_MEMORYERROR;
+		}
+		for (int c = 0; c < noColumns; c++) {
+			int length = row[c].data ? row[c].length : 0;
+			columns[c].offsets[r + 1] = columns[c].offsets[r] + length + 1;
+		}
+	}
+	for (int c = 0; c < noColumns; c++) {
+		columns[c].bytes = (char *) malloc(columns[c].offsets[noRows] + 1);
+		if (!columns[c].bytes) {
+			dropColumns();
+			return CSV_MEMORYERROR;
+		}
+		CSV_ALLOC(columns[c].offsets[noRows] + 1);
+	}
+
+// Copy the cells
+	for (int r = 0; r < noRows; r++) {
+		CSVCell * row = cellRow(r);
+		if (!row) {
+			dropColumns();
+			return CSV_MEMORYERROR;
+		}
+		for (int c = 0; c < noColumns; c++) {
+			char * dst = &columns[c].bytes[columns[c].offsets[r]];
+			int length = (int) (columns[c].offsets[r + 1] - columns[c].offsets[r] - 1);
+			if (length) memcpy(dst, row[c].data, length);
+			dst[length] = 0;
+		}
+	}
+	return CSV_NOERROR;
+}
+
+void CSVFile::dropColumns()
+{
+	if (!columns) return;
+	for (int c = 0; c < noStoredColumns; c++) {
+		free(columns[c].offsets);
+		free(columns[c].bytes);
+	}
+	free(columns);
+	columns = NULL;
+	noStoredColumns = 0;
+}
+
+/*****************************************************************************/
+char * CSVFile::allocString(const char * data, int length)
+{
+#ifdef CSV_STATS
+// A new block goes in front of the arena, or right behind its first block
+	CSVBlock * first = arena;
+	CSVBlock * second = arena ? arena->next : NULL;
+	char * ns = arenaString(arena, data, length);
+	CSVBlock * block = arena != first ? arena : (arena && arena->next != second ? arena->next : NULL);
+	if (block) CSV_ALLOC(sizeof(CSVBlock) + block->size);
+	return ns;
+#else
+	return arenaString(arena, data, length);
+#endif
+}
+
+/*****************************************************************************/
+void CSVFile::secureString(char * string)
+{
+	if (!string) return;
+// Substitute characters used to format
+	int c;
+	while((c = *string++)) {
+		if ((c < ' ' && c != '\t') || (c == separator) || (c == rem))
+			string[-1] = substitute;
+	}
+}
+
+/*****************************************************************************/
+CSV_ERRORS CSVFile::read(bool keepInMem)
+{
+// Release previous content
+	freeContent();
+	CSV_ERRORS error;
+	if ((flags & CSV_SNAPSHOT) && !loadSnapshot())
+		return (flags & CSV_COLUMNAR) ? buildColumns() : CSV_NOERROR;
+
+// A buffer kept by an earlier read may be older than the file its snapshot would stamp
+	bool fresh = !ramFile;
+	if (flags & CSV_LAZY) {
+		error = parseLazy();
+		if (!error && fresh && (flags & CSV_SNAPSHOT)) saveSnapshot();
+		return error;
+	}
+
+// Allocate memory
+	bool pipelined = (flags & CSV_PIPELINED) && !(flags & (CSV_PARALLEL | CSV_MAPPED));
+	if (pipelined) {
+	// Tables grow while the file is read
+		noRows = 0;
+		noColumns = 0;
+		noComments = 0;
+		error = parsePipelined();
+	}else if (flags & CSV_PARALLEL) {
+	// Tables are sized by counting chunks in parallel
+		error = resolveProjection();
+		if (!error) error = load();
+		if (error) return error;
+	}else if (flags & CSV_SINGLEPASS) {
+	// Tables grow while parsing
+		error = resolveProjection();
+		if (!error) error = load();
+		if (error) return error;
+		noRows = 0;
+		noColumns = 0;
+		noComments = 0;
+	}else{
+	// Tables are sized by a first pass
+		int countRows;
+		int countColumns;
+		int countComments;
+		int countLineChars;
+		error = assess(countRows, countColumns, countComments, countLineChars, true);
+		if (error) return error;
+		error = reallocate(countRows, countColumns, countComments);
+		if (error) return error;
+	}
+
+// Parse the file
+	if (!pipelined) error = (flags & CSV_PARALLEL) ? parseParallel() : parse();
+	if (!error && (flags & CSV_COLUMNAR)) error = buildColumns();
+
+// Hand the buffer over to the cells
+	if (flags & CSV_INSITU) {
+		contentFile = ramFile;
+		contentFileLen = ramFileLen;
+		contentFileMapped = ramFileMapped;
+		ramFile = NULL;
+		ramFileLen = 0;
+		ramFileMapped = false;
+	}
+
+// Unload the file
+	if (!keepInMem) unload();
+	if (!error && fresh && (flags & CSV_SNAPSHOT)) saveSnapshot();
+	return error;
+}
+
+CSV_ERRORS CSVFile::parseLazy()
+{
+// Load the file
+	CSV_ERRORS error = resolveProjection();
+	if (!error) error = load();
+	if (error) return error;
+	CSV_PHASE(parseTime);
+	lazy = (CSVLazy *) calloc(1, sizeof(CSVLazy));
+	if (!lazy) return CSV_MEMORYERROR;
+	lazy->first = -1;
+	lazy->last = -1;
+
+// Locate the rows, store the comments
+	CSVSplitter splitter(ramFile, ramFileLen, separator, rem, quote, kernel);
+	int row = 0, comment = 0, maxColumns = 0, noAllocatedLines = 0;
+	long long lineStart = 0;
+	while (!error && splitter.split()) {
+		if (splitter.commentOnLine) {
+			error = reserve(0, 0, comment + 1, true);
+			if (error) break;
+			CSVView & text = splitter.comment;
+			if (text.length) {
+				comments[comment].data = arenaString(arena, text.data, text.length);
+				comments[comment].length = text.length;
+				if (!comments[comment].data) {error = CSV_MEMORYERROR; break;}
+			}
+			comment++;
+		}
+		if (splitter.noFields > maxColumns) maxColumns = splitter.noFields;
+		if (splitter.rowLine && keepRow(splitter.fields, splitter.noFields)) {
+			if (row >= noAllocatedLines) {
+				noAllocatedLines = noAllocatedLines ? noAllocatedLines * 2 : 1024;
+				long long * nl = (long long *) realloc(lazy->lines, sizeof(long long) * 2 * noAllocatedLines);
+				if (!nl) {error = CSV_MEMORYERROR; break;}
+				lazy->lines = nl;
+			}
+			lazy->lines[row * 2] = lineStart;
+			lazy->lines[row * 2 + 1] = splitter.lineStart;
+			row++;
+		}
+		lineStart = splitter.lineStart;
+	}
+	if (!error) error = splitter.error;
+	if (!error && splitter.commentOnLine) {
+		error = reserve(0, 0, comment + 1, true);
+		if (!error) comment++;
+	}
+
+// Prepare the cache
+	if (!error) {
+		lazy->noSlots = lazyCacheRows < row ? lazyCacheRows : row;
+		if (lazy->noSlots < 1) lazy->noSlots = 1;
+		lazy->cache = (CSVLazyRow *) calloc(lazy->noSlots, sizeof(CSVLazyRow));
+		lazy->slots = (int *) malloc(sizeof(int) * (row ? row : 1));
+		if (!lazy->cache || !lazy->slots) error = CSV_MEMORYERROR;
+		else for (int r = 0; r < row; r++) lazy->slots[r] = -1;
+	}
+	noRows = row;
+	noColumns = projection && maxColumns ? noProjected : maxColumns;
+	noComments = comment;
+	CSV_COUNT(parseBytes, ramFileLen);
+	CSV_BLOCKS(arena);
+	CSV_ALLOC(sizeof(long long) * 2 * noAllocatedLines);
+	if (error) {
+		dropLazy();
+		noRows = 0;
+	}
+
+// Keep the file for the rows parsed later
+	contentFile = ramFile;
+	contentFileLen = ramFileLen;
+	contentFileMapped = ramFileMapped;
+	ramFile = NULL;
+	ramFileLen = 0;
+	ramFileMapped = false;
+	return error;
+}
+
+/*****************************************************************************/
+struct CSVHeader {
+	char ** names;
+	int * columns;
+	int noNames;
+};
+
+static bool matchHeader(void * user, int row, const CSVView * fields, int noFields)
+{
+// Find the names in the first row
+	CSVHeader * header = (CSVHeader *) user;
+	for (int n = 0; n < header->noNames; n++) {
+		int length = strlen(header->names[n]);
+		for (int f = 0; f < noFields; f++)
+			if (fields[f].length == length && !memcmp(fields[f].data, header->names[n], length)) {
+				header->columns[n] = f;
+				break;
+			}
+	}
+	return false;
+}
+
+CSV_ERRORS CSVFile::resolveProjection()
+{
+	if (!projectionNames) return CSV_NOERROR;
+// Look the names up in the header
+	CSVHeader header = {projectionNames, projection, noProjected};
+	for (int n = 0; n < noProjected; n++)
+		projection[n] = -1;
+	CSV_ERRORS error = stream(matchHeader, &header);
+	if (error) return error;
+	for (int n = 0; n < noProjected; n++)
+		if (projection[n] < 0) return CSV_FORMATERROR;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::parse()
+{
+// Parse the whole file at once
+	CSV_PHASE(parseTime);
+	CSVChunk chunk;
+	memset(&chunk, 0, sizeof(CSVChunk));
+	chunk.end = ramFileLen;
+	parseChunk(chunk, true);
+	CSV_COUNT(parseBytes, ramFileLen);
+	CSV_BLOCKS(chunk.arena);
+	arenaSplice(arena, chunk.arena);
+	noRows = chunk.noRows;
+	noColumns = chunk.noColumns;
+	noComments = chunk.noComments;
+	return chunk.error;
+}
+
+CSV_ERRORS CSVFile::parsePipelined()
+{
+// Open the CSV file, allocate the file buffer (reading overlaps parsing)
+	CSV_PHASE(parseTime);
+	CSV_ERRORS error = resolveProjection();
+	if (error) return error;
+	if (!path) return CSV_BADFILENAME;
+	CSVReader reader;
+	error = reader.open(path);
+	if (error) return error;
+	if (reader.codec) {
+	// The decoded size is unknown, load the whole file first
+		reader.close();
+		error = load();
+		return error ? error : parse();
+	}
+	FILE * in = reader.file;
+	fseek(in, 0, SEEK_END);
+	long long len = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	ramFile = (char *) malloc(len ? len : 1);
+	if (!ramFile) return CSV_MEMORYERROR;
+	ramFileLen = len;
+	CSV_ALLOC(len);
+	CSV_PEAK(len);
+	CSV_COUNT(loadBytes, len);
+
+// Read the file block by block on a background thread
+	CSVPipeline pipe;
+	pipe.loaded = 0;
+	pipe.done = false;
+	pipe.stop = false;
+	pipe.error = CSV_NOERROR;
+	long long block = pipelineBlockSize > 0 ? pipelineBlockSize : 1;
+	char * buffer = ramFile;
+	std::thread loader([&]() {
+		long long loaded = 0;
+		CSV_ERRORS readError = CSV_NOERROR;
+		while (loaded < len) {
+			long long size = len - loaded < block ? len - loaded : block;
+			if (fread(&buffer[loaded], size, 1, in) != 1) {readError = CSV_FILEERROR; break;}
+			loaded += size;
+			std::lock_guard<std::mutex> guard(pipe.lock);
+			pipe.loaded = loaded;
+			pipe.ready.notify_one();
+			if (pipe.stop) break;
+		}
+		std::lock_guard<std::mutex> guard(pipe.lock);
+		pipe.error = readError;
+		pipe.done = true;
+		pipe.ready.notify_one();
+	});
+
+// Parse the complete lines of each new block
+	CSVMasker masker = selectMasker(kernel);
+	long long parsed = 0;
+	long long scanned = 0;
+	bool inQuote = false;
+	bool inComment = false;
+	while (!error) {
+		long long loaded;
+		bool done;
+		{
+			std::unique_lock<std::mutex> guard(pipe.lock);
+			pipe.ready.wait(guard, [&]() {return pipe.done || pipe.loaded > scanned;});
+			loaded = pipe.loaded;
+			done = pipe.done;
+			error = pipe.error;
+		}
+		if (error) break;
+
+	// Stop after the last new line end (lines before were all parsed)
+		long long end = loaded;
+		if (!done && quote) {
+		// Line ends within quotes do not count
+			end = quoteScan(ramFile, scanned, loaded, rem, quote, masker, inQuote, inComment, false);
+			if (end < 0) end = parsed;
+		}else if (!done) {
+			while (end > scanned && ramFile[end - 1] != '\r' && ramFile[end - 1] != '\n') end--;
+			if (end == scanned) end = parsed;
+		}
+		scanned = loaded;
+		if (end == parsed && !done) continue;
+
+	// Append the rows and comments
+		CSVChunk chunk;
+		memset(&chunk, 0, sizeof(CSVChunk));
+		chunk.start = parsed;
+		chunk.end = end;
+		chunk.row = noRows;
+		chunk.comment = noComments;
+		parseChunk(chunk, true);
+		CSV_COUNT(parseBytes, end - parsed);
+		CSV_BLOCKS(chunk.arena);
+		arenaSplice(arena, chunk.arena);
+		noRows += chunk.noRows;
+		noComments += chunk.noComments;
+		if (chunk.noColumns > noColumns) noColumns = chunk.noColumns;
+		error = chunk.error;
+		parsed = end;
+		if (done) break;
+	}
+
+// Stop the I/O thread
+	{
+		std::lock_guard<std::mutex> guard(pipe.lock);
+		pipe.stop = true;
+	}
+	loader.join();
+	return error;
+}
+
+int CSVFile::splitChunks(CSVChunk * & chunks, long long end)
+{
+// Split the file in chunks starting on new lines
+	int noChunks = threads > 0 ? threads : (int) std::thread::hardware_concurrency();
+	if (noChunks < 1) noChunks = 1;
+	if (noChunks > end / minChunkLen) noChunks = (int) (end / minChunkLen) + 1;
+	chunks = (CSVChunk *) calloc(noChunks, sizeof(CSVChunk));
+	if (!chunks) return 0;
+	for (int i = 1; i < noChunks; i++) {
+		long long k = end * i / noChunks;
+		if (k < chunks[i - 1].start) k = chunks[i - 1].start;
+		while (k < end && ramFile[k - 1] != '\r' && ramFile[k - 1] != '\n') k++;
+		chunks[i].start = k;
+		chunks[i - 1].end = k;
+	}
+	chunks[noChunks - 1].end = end;
+	if (!quote || noChunks == 1) return noChunks;
+
+// A new line may be quoted: scan each chunk from both states in parallel
+	CSVMasker masker = selectMasker(kernel);
+	bool * quoted = (bool *) malloc(sizeof(bool) * 2 * noChunks);
+	if (!quoted) {
+		free(chunks);
+		chunks = NULL;
+		return 0;
+	}
+	runParallel(noChunks, [&](int i) {
+		for (int state = 0; state < 2; state++) {
+			bool inQuote = state != 0;
+			bool inComment = false;
+			quoteScan(ramFile, chunks[i].start, chunks[i].end, rem, quote, masker, inQuote, inComment, false);
+			quoted[2 * i + state] = inQuote;
+		}
+	});
+
+// Chain the states, move the starts within quotes past the next line end
+	bool inQuote = false;
+	for (int i = 1; i < noChunks; i++) {
+		inQuote = quoted[2 * (i - 1) + inQuote];
+		if (!inQuote) continue;
+		bool inField = true;
+		bool inComment = false;
+		long long k = quoteScan(ramFile, chunks[i].start, end, rem, quote, masker, inField, inComment, true);
+		chunks[i].start = k < 0 ? end : k;
+		chunks[i - 1].end = chunks[i].start;
+	}
+	free(quoted);
+	return noChunks;
+}
+
+CSV_ERRORS CSVFile::parseParallel()
+{
+// Split the file in chunks starting on new lines
+	CSV_PHASE(parseTime);
+	CSVChunk * chunks;
+	int noChunks = splitChunks(chunks, ramFileLen);
+	if (!noChunks) return CSV_MEMORYERROR;
+
+// Count rows and comments of each chunk
+	runParallel(noChunks, [&](int i) {countChunk(chunks[i]);});
+
+// Prefix-sum the counts and size the tables
+	CSV_ERRORS error = CSV_NOERROR;
+	int countRows = 0;
+	int countColumns = 0;
+	int countComments = 0;
+	for (int i = 0; i < noChunks; i++) {
+		if (!error) error = chunks[i].error;
+		chunks[i].row = countRows;
+		chunks[i].comment = countComments;
+		countRows += chunks[i].noRows;
+		countComments += chunks[i].noComments;
+		if (chunks[i].noColumns > countColumns)
+			countColumns = chunks[i].noColumns;
+	}
+	if (!error) error = reallocate(countRows, countColumns, countComments);
+
+// Parse the chunks in their place
+	if (!error) runParallel(noChunks, [&](int i) {parseChunk(chunks[i], false);});
+	for (int i = 0; i < noChunks; i++) {
+		if (!error) error = chunks[i].error;
+		CSV_BLOCKS(chunks[i].arena);
+		arenaSplice(arena, chunks[i].arena);
+	}
+	CSV_COUNT(parseBytes, ramFileLen);
+	free(chunks);
+	return error;
+}
+
+inline bool CSVFile::keepRow(const CSVView * fields, int noFields)
+{
+// Rows pass without a filter
+	if (!filter) return true;
+
+// Test the filtered field
+	CSVView field = {NULL, 0};
+	if (filter->column < noFields) field = fields[filter->column];
+	switch (filter->type) {
+	case CSV_FILTER_EQUAL:
+		if (field.length != filter->length) return false;
+		return !field.length || !memcmp(field.data, filter->text, field.length);
+	case CSV_FILTER_PREFIX:
+		if (field.length < filter->length) return false;
+		return !filter->length || !memcmp(field.data, filter->text, filter->length);
+	case CSV_FILTER_RANGE: {
+		double value;
+		if (!parseDouble(field.data, field.length, false, value)) return false;
+		return value >= filter->min && value <= filter->max;
+	}
+	case CSV_FILTER_CALLBACK:
+		return filter->test(filter->user, field);
+	}
+	return true;
+}
+
+void CSVFile::countChunk(CSVChunk & chunk)
+{
+// Filters need the fields of every line
+	if (filter) {
+		statChunk(chunk);
+		free(chunk.widths);
+		chunk.widths = NULL;
+		chunk.noWidths = 0;
+		return;
+	}
+
+// Classify the bytes 64 at a time, count with bit operations
+	CSVMasker masker = selectMasker(kernel);
+	const char * data = &ramFile[chunk.start];
+	long long length = chunk.end - chunk.start;
+	int cRow = 0;
+	int cColumn = 0;
+	int cComment = 0;
+	long long lastLine = chunk.start ? -1 : 0;
+	long long lineMaxLen = 0;
+	int noSeparators = 0;
+	bool inComment = false;
+	bool inQuote = false;
+	bool firstDone = false;
+	bool firstContent = false;
+	for (long long base = 0; base < length; base += 64) {
+	// Classify a block (the last one is padded)
+		unsigned long long masks[5];
+		long long left = length - base;
+		if (left >= 64) masker(&data[base], separator, rem, quote, masks);
+		else{
+			char tail[64];
+			memset(tail, 0, 64);
+			memcpy(tail, &data[base], left);
+			masker(tail, separator, rem, quote, masks);
+			unsigned long long valid = (1ULL << left) - 1;
+			for (int m = 0; m < 5; m++) masks[m] &= valid;
+		}
+		unsigned long long quotes = quote ? masks[4] : 0;
+		unsigned long long lineEnds = masks[0];
+		unsigned long long from = ~0ULL;
+		while (1) {
+		// Mask the bytes between quotes (blocks without quotes skip this)
+			unsigned long long inside = 0;
+			if ((quotes || inQuote) && !inComment) {
+				inside = prefixXor(quotes & from);
+				if (inQuote) inside = ~inside;
+				inside &= from;
+				lineEnds = masks[0] & from & ~inside;
+			}
+
+		// Segment of a line within the block
+			unsigned long long to = lineEnds ? (lineEnds & (0 - lineEnds)) - 1 : ~0ULL;
+			unsigned long long segment = from & to;
+			if (!inComment) {
+				unsigned long long open = segment & ~inside;
+				unsigned long long rems = masks[2] & open;
+				unsigned long long before = rems ? segment & ((rems & (0 - rems)) - 1) : segment;
+				unsigned long long seps = masks[1] & before & ~inside;
+				noSeparators += __builtin_popcountll(seps);
+				if (!firstDone) {
+				// Look for content in the first field
+					unsigned long long stops = (masks[1] | masks[2]) & open;
+					unsigned long long first = stops ? segment & ((stops & (0 - stops)) - 1) : segment;
+					if (first & ~masks[3] & ~masks[0]) firstContent = true;
+					if (stops) firstDone = true;
+				}
+				if (rems) {
+					inComment = true;
+					cComment++;
+					if (quotes & from) {
+					// Comments ignore quotes, look for the line end again
+						unsigned long long mark = rems & (0 - rems);
+						from = ~(mark | (mark - 1));
+						lineEnds = masks[0] & from;
+						inQuote = false;
+						continue;
+					}
+				}
+			}
+			if (!lineEnds) {
+				if (!inComment) inQuote ^= __builtin_popcountll(quotes & from) & 1;
+				break;
+			}
+
+		// Close the line
+			if (noSeparators || firstContent) cRow++;
+			if (noSeparators + 1 > cColumn) cColumn = noSeparators + 1;
+			long long newLine = base + __builtin_ctzll(lineEnds);
+			if (newLine - lastLine > lineMaxLen)
+				lineMaxLen = newLine - lastLine;
+			lastLine = newLine;
+			noSeparators = 0;
+			inComment = false;
+			inQuote = false;
+			firstDone = false;
+			firstContent = false;
+			from = ~to << 1;
+			lineEnds &= lineEnds - 1;
+		}
+	}
+	if (projection && cColumn) cColumn = noProjected;
+	chunk.noRows = cRow;
+	chunk.noColumns = cColumn;
+	chunk.noComments = cComment;
+	chunk.noLineChars = (int) lineMaxLen;
+	chunk.error = CSV_NOERROR;
+}
+
+void CSVFile::statChunk(CSVChunk & chunk)
+{
+// Split all lines
+	CSVSplitter splitter(&ramFile[chunk.start], chunk.end - chunk.start, separator, rem, quote, kernel);
+	int cRow = 0;
+	int cColumn = 0;
+	int cComment = 0;
+	long long lastLine = chunk.start ? -1 : 0;
+	long long lineMaxLen = 0;
+	CSV_ERRORS error = CSV_NOERROR;
+	while (!error && splitter.split()) {
+		int noFields = splitter.noFields;
+		CSVView * fields = splitter.fields;
+		if (noFields > cColumn) cColumn = noFields;
+		if (splitter.commentOnLine) cComment ++;
+
+	// Count line length
+		long long newLine = splitter.lineStart - 1;
+		if (newLine - lastLine > lineMaxLen)
+			lineMaxLen = newLine - lastLine;
+		lastLine = newLine;
+		if (!splitter.rowLine || !keepRow(fields, noFields)) continue;
+
+	// Count the row and its fields
+		cRow++;
+		if (noFields > chunk.maxFields) {
+			chunk.maxFields = noFields;
+			chunk.noMaxFieldRows = 0;
+		}
+		if (noFields == chunk.maxFields) chunk.noMaxFieldRows++;
+		int noColumns = projection ? noProjected : noFields;
+		if (noColumns > chunk.noWidths) {
+			int * nw = (int *) realloc(chunk.widths, sizeof(int) * noColumns);
+			if (!nw) {error = CSV_MEMORYERROR; break;}
+			memset(&nw[chunk.noWidths], 0, sizeof(int) * (noColumns - chunk.noWidths));
+			chunk.widths = nw;
+			chunk.noWidths = noColumns;
+		}
+		for (int c = 0; c < noColumns; c++) {
+			int f = projection ? projection[c] : c;
+			if (f < 0 || f >= noFields || !fields[f].length) continue;
+			chunk.noFilledCells++;
+			if (fields[f].length > chunk.widths[c]) chunk.widths[c] = fields[f].length;
+		}
+	}
+	if (splitter.commentOnLine) cComment ++;
+	if (projection && cColumn) cColumn = noProjected;
+	chunk.noRows = cRow;
+	chunk.noColumns = cColumn;
+	chunk.noComments = cComment;
+	chunk.noLineChars = (int) lineMaxLen;
+	chunk.error = error ? error : splitter.error;
+}
+
+void CSVFile::parseChunk(CSVChunk & chunk, bool grow)
+{
+// Initialise the parser (lines are split once, in-situ fields unescape in place)
+	bool inPlace = (flags & CSV_INSITU) && !ramFileMapped;
+	CSVSplitter splitter(&ramFile[chunk.start], chunk.end - chunk.start, separator, rem, quote, kernel, inPlace);
+	CSV_ERRORS error = CSV_NOERROR;
+	int row = chunk.row;
+	int comment = chunk.comment;
+	int maxColumns = 0;
+
+// Parse the chunk line by line
+	while (!error && splitter.split()) {
+		int noFields = splitter.noFields;
+		CSVView * fields = splitter.fields;
+
+	// Store the comment
+		if (splitter.commentOnLine) {
+			if (grow) error = reserve(0, 0, comment + 1, true);
+			if (error) break;
+			CSVView & text = splitter.comment;
+			if (text.length) error = storeString(comments[comment], text, false, chunk.arena);
+			comment++;
+		}
+
+	// Store the row
+		int noColumns = projection ? noProjected : noFields;
+		if (noColumns > maxColumns) maxColumns = noColumns;
+		if (!error && splitter.rowLine && keepRow(fields, noFields)) {
+			if (grow) error = reserve(row + 1, noColumns, 0, true);
+			if (error) break;
+			CSVCell * cells = tableRow(row);
+			if (projection) {
+			// Only copy the selected fields
+				for (int c = 0; c < noProjected && !error; c++) {
+					int f = projection[c];
+					if (f >= 0 && f < noFields && fields[f].length)
+						error = storeString(cells[c], fields[f], splitter.scratched(fields[f]), chunk.arena);
+				}
+			}else{
+				for (int f = 0; f < noFields && !error; f++)
+					if (fields[f].length) error = storeString(cells[f], fields[f], splitter.scratched(fields[f]), chunk.arena);
+			}
+			row++;
+		}
+	}
+	if (!error) error = splitter.error;
+
+// Count a comment started on the unterminated last line
+	if (!error && splitter.commentOnLine) {
+		if (grow) error = reserve(0, 0, comment + 1, true);
+		if (!error) comment++;
+	}
+
+// Size the tables
+	if (!error && grow) error = reserve(row, maxColumns, comment, true);
+	chunk.noRows = row - chunk.row;
+	chunk.noColumns = maxColumns;
+	chunk.noComments = comment - chunk.comment;
+	chunk.error = error;
+}
+
+CSV_ERRORS CSVFile::storeString(CSVCell & cell, const CSVView & text, bool transient, CSVBlock * & arena)
+{
+	const char * data = text.data;
+	int length = text.length;
+	cell.length = length;
+	if ((flags & CSV_INSITU) && !transient) {
+	// Point into the file buffer, terminate in place when writable
+		cell.data = data;
+		cell.view = ramFileMapped;
+		if (!ramFileMapped) ((char *) data)[length] = 0;
+		return CSV_NOERROR;
+	}
+// Copy into the arena
+	cell.data = arenaString(arena, data, length);
+	cell.view = false;
+	return cell.data ? CSV_NOERROR : CSV_MEMORYERROR;
+}
+
+CSV_ERRORS CSVFile::stream(CSVRowHandler onRow, void * user, int bufferSize, CSVCommentHandler onComment)
+{
+// Open the CSV file
+	if (!path) return CSV_BADFILENAME;
+	CSVReader reader;
+	CSV_ERRORS error = reader.open(path);
+	if (error) return error;
+
+// Allocate the refill buffer
+	CSV_PHASE(parseTime);
+	if (bufferSize < 256) bufferSize = 256;
+	char * buffer = (char *) malloc(bufferSize);
+	if (!buffer) return CSV_MEMORYERROR;
+	CSV_ALLOC(bufferSize);
+	CSV_PEAK(bufferSize);
+	CSVSplitter splitter(buffer, 0, separator, rem, quote, kernel);
+	error = splitter.error;
+	int used = 0;
+	int row = 0;
+	int comment = 0;
+	bool stop = false;
+
+	while (!error && !stop) {
+	// Refill the buffer after the pending line
+		long long len = reader.read(&buffer[used], bufferSize - used);
+		if (reader.error) {error = reader.error; break;}
+		used += (int) len;
+		bool eof = (len == 0);
+		CSV_COUNT(loadBytes, len);
+		CSV_COUNT(parseBytes, len);
+
+	// Hand over the complete lines
+		splitter.reset(buffer, used);
+		while (!stop && splitter.split()) {
+			if (splitter.commentOnLine) {
+				CSVView text = splitter.comment;
+				if (!text.length) text.data = NULL;
+				if (onComment && !onComment(user, comment, text)) stop = true;
+				comment++;
+			}
+			if (stop || !splitter.rowLine) continue;
+			if (onRow && !onRow(user, row, splitter.fields, splitter.noFields)) stop = true;
+			row++;
+		}
+		error = splitter.error;
+		if (stop || error) break;
+
+	// A comment on the unterminated last line has no text
+		if (eof) {
+			if (splitter.commentOnLine && onComment) {
+				CSVView text = {NULL, 0};
+				onComment(user, comment, text);
+			}
+			break;
+		}
+
+	// Keep the pending line, grow the buffer if it fills it
+		int pending = used - (int) splitter.lineStart;
+		memmove(buffer, &buffer[splitter.lineStart], pending);
+		used = pending;
+		if (used == bufferSize) {
+			char * nb = (char *) realloc(buffer, bufferSize * 2);
+			if (!nb) {error = CSV_MEMORYERROR; break;}
+			buffer = nb;
+			bufferSize *= 2;
+			CSV_ALLOC(bufferSize);
+			CSV_PEAK(bufferSize);
+		}
+	}
+
+// Close the CSV file
+	free(buffer);
+	return error;
+}
+
+CSV_ERRORS CSVFile::write()
+{
+// Open the CSV file
+	if (!path) return CSV_BADFILENAME;
+	if (writeBufferSize > 0 || pathCodec(path) || quote) return writeBuffered();
+	CSV_PHASE(writeTime);
+	file = fopen(path, "wb");
+	if (!file) return CSV_FILEERROR;
+	clearerr(file);
+
+// Write comments
+	for (int c = 0; c < noComments; c++) {
+		fwrite(&rem, 1, 1, file);
+		if (comments[c].data) fwrite(comments[c].data, comments[c].length, 1, file);
+		fwrite(eol, eolLen, 1, file);
+	}
+
+// Write rows
+	for (int r = 0; r < noRows; r++) {
+		CSVCell * row = cellRow(r);
+		for (int c = 0; c < noColumns; c++) {
+			if (row && row[c].data) fwrite(row[c].data, row[c].length, 1, file);
+			if (c != noColumns - 1) fwrite(&separator, 1, 1, file);
+		}
+		fwrite(eol, eolLen, 1, file);
+	}
+
+// Detect any error
+	if (ferror(file)) {
+		fclose(file);
+		file = NULL;
+		return CSV_FILEERROR;
+	}
+
+// Close the CSV file
+	CSV_COUNT(writeBytes, ftell(file));
+	fclose(file);
+	file = NULL;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::writeBuffered()
+{
+// Open the CSV file
+	CSV_PHASE(writeTime);
+	CSVWriter writer;
+	int workers = threads > 0 ? threads : (int) std::thread::hardware_concurrency();
+	if (!(flags & CSV_PARALLEL)) workers = 0;
+	CSV_ERRORS error = writer.open(path, writeBufferSize > 0 ? writeBufferSize : 65536, (flags & CSV_DIRECTIO) != 0, false, workers);
+	if (error) return error;
+
+// Write the content
+	CSV_ALLOC(writer.size);
+	CSV_PEAK(writer.size);
+	writeContent(writer);
+	error = writer.close();
+	CSV_COUNT(writeBytes, writer.written);
+	return error;
+}
+
+void CSVFile::writeContent(CSVWriter & writer)
+{
+// Write comments
+	for (int c = 0; c < noComments; c++) {
+		writer.put(&rem, 1);
+		if (comments[c].data) writer.put(comments[c].data, comments[c].length);
+		writer.put(eol, eolLen);
+	}
+
+// Write rows
+	for (int r = 0; r < noRows; r++) {
+		CSVCell * row = cellRow(r);
+		for (int c = 0; c < noColumns; c++) {
+			if (quote) writeField(writer, row ? row[c].data : NULL, row && row[c].data ? row[c].length : 0, noColumns == 1);
+			else if (row && row[c].data) writer.put(row[c].data, row[c].length);
+			if (c != noColumns - 1) writer.put(&separator, 1);
+		}
+		writer.put(eol, eolLen);
+	}
+}
+
+void CSVFile::writeSecure(CSVWriter & writer, const char * data, int length)
+{
+// Substitute characters used to format
+	int start = 0;
+	for (int i = 0; i < length; i++) {
+		char c = data[i];
+		if ((c < ' ' && c != '\t') || (c == separator) || (c == rem)) {
+			writer.put(&data[start], i - start);
+			writer.put(&substitute, 1);
+			start = i + 1;
+		}
+	}
+	writer.put(&data[start], length - start);
+}
+
+void CSVFile::writeField(CSVWriter & writer, const char * data, int length, bool alone)
+{
+// Write plain fields as they are
+	int k = 0;
+	while (k < length) {
+		char c = data[k];
+		if (c == separator || c == quote || c == rem || c == '\r' || c == '\n') break;
+		k++;
+	}
+	if (k == length && (!alone || hasContent(data, length))) {
+		if (length) writer.put(data, length);
+		return;
+	}
+
+// Quote the others, a blank field alone on its line stays a row
+	writer.put(&quote, 1);
+	int start = 0;
+	for (int i = k; i < length; i++) {
+		if (data[i] != quote) continue;
+	// Double the quotes
+		writer.put(&data[start], i + 1 - start);
+		start = i;
+	}
+	if (length > start) writer.put(&data[start], length - start);
+	writer.put(&quote, 1);
+}
+
+/*****************************************************************************/
+static bool firstRow(void * user, int row, const CSVView * fields, int noFields)
+{
+	*(int *) user = noFields;
+	return false;
+}
+
+CSV_ERRORS CSVFile::checkAppend(int noColumns, bool & needEOL)
+{
+// Check the last character
+	needEOL = false;
+	CSVReader reader;
+	CSV_ERRORS error = reader.open(path);
+	if (error == CSV_FILEERROR) return CSV_NOERROR;
+	if (error) return error;
+	if (!reader.codec) {
+		if (fseek(reader.file, -1, SEEK_END) == 0) {
+			int last = fgetc(reader.file);
+			needEOL = last != '\r' && last != '\n';
+		}
+	}else{
+	// Compressed files are decoded to their end
+		char block[4096];
+		int last = -1;
+		long long n;
+		while ((n = reader.read(block, sizeof(block))) > 0)
+			last = block[n - 1];
+		if (reader.error) return reader.error;
+		needEOL = last >= 0 && last != '\r' && last != '\n';
+	}
+	reader.close();
+
+// Compare the first row layout
+	if (noColumns <= 0) return CSV_NOERROR;
+	int fileColumns = 0;
+	error = stream(firstRow, &fileColumns);
+	if (error) return error;
+	if (fileColumns && fileColumns != noColumns) return CSV_FORMATERROR;
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::append()
+{
+// Check the existing file
+	if (!path) return CSV_BADFILENAME;
+	bool needEOL;
+	CSV_ERRORS error = checkAppend(noRows ? noColumns : 0, needEOL);
+	if (error) return error;
+
+// Open the CSV file at its end
+	CSVWriter writer;
+	error = writer.open(path, writeBufferSize > 0 ? writeBufferSize : 65536, false, true);
+	if (error) return error;
+
+// Write the content
+	if (needEOL) writer.put(eol, eolLen);
+	writeContent(writer);
+	return writer.close();
+}
+
+/*****************************************************************************/
+CSV_ERRORS CSVFile::openAppend(int noColumns)
+{
+// Check the existing file
+	closeAppend();
+	if (!path) return CSV_BADFILENAME;
+	if (noColumns < 1) return CSV_FORMATERROR;
+	bool needEOL;
+	CSV_ERRORS error = checkAppend(noColumns, needEOL);
+	if (error) return error;
+
+// Open the sink
+	sink = new CSVWriter;
+	error = sink->open(path, writeBufferSize > 0 ? writeBufferSize : 65536, false, true);
+	if (error) {
+		delete sink;
+		sink = NULL;
+		return error;
+	}
+	sinkColumns = noColumns;
+	if (needEOL) sink->put(eol, eolLen);
+	return CSV_NOERROR;
+}
+
+CSV_ERRORS CSVFile::appendRow(const char * const * fields, int noFields)
+{
+	if (!sink) return CSV_FILEERROR;
+	if (noFields > sinkColumns) return CSV_FORMATERROR;
+// Format the row
+	for (int c = 0; c < sinkColumns; c++) {
+		const char * field = c < noFields ? fields[c] : NULL;
+		if (quote) writeField(*sink, field, field ? strlen(field) : 0, sinkColumns == 1);
+		else if (field) writeSecure(*sink, field, strlen(field));
+		if (c != sinkColumns - 1) sink->put(&separator, 1);
+	}
+	sink->put(eol, eolLen);
+	return sink->error;
+}
+
+CSV_ERRORS CSVFile::appendComment(const char * comment)
+{
+	if (!sink) return CSV_FILEERROR;
+// Format the comment
+	sink->put(&rem, 1);
+	if (comment) writeSecure(*sink, comment, strlen(comment));
+	sink->put(eol, eolLen);
+	return sink->error;
+}
+
+CSV_ERRORS CSVFile::appendRow(const double * values, int noValues)
+{
+	if (!sink) return CSV_FILEERROR;
+	if (noValues > sinkColumns) return CSV_FORMATERROR;
+// Format the numbers
+	char number[32];
+	for (int c = 0; c < sinkColumns; c++) {
+		if (c < noValues) writeSecure(*sink, number, formatDouble(number, values[c]));
+		if (c != sinkColumns - 1) sink->put(&separator, 1);
+	}
+	sink->put(eol, eolLen);
+	return sink->error;
+}
+
+CSV_ERRORS CSVFile::flushAppend()
+{
+	if (!sink) return CSV_FILEERROR;
+	return sink->flush(true);
+}
+
+CSV_ERRORS CSVFile::closeAppend()
+{
+	if (!sink) return CSV_NOERROR;
+	CSV_ERRORS error = sink->close();
+	delete sink;
+	sink = NULL;
+	return error;
+}
+
+/*****************************************************************************/
+CSV_ERRORS CSVFile::assess(int & countRows, int & countColumns, int & countComments, int & countLineChars, bool keepInMem)
+{
+// Load the file
+	CSV_ERRORS error = resolveProjection();
+	if (!error) error = load();
+	if (error) return error;
+
+// Count all elements
+	CSVStats stats;
+	error = assessChunks(stats, ramFileLen, false);
+
+// Unload the file
+	if (!keepInMem) unload();
+	countRows = stats.noRows;
+	countColumns = stats.noColumns;
+	countComments = stats.noComments;
+	countLineChars = stats.noLineChars;
+	return error;
+}
+
+CSV_ERRORS CSVFile::assess(CSVStats & stats, long long sampleBytes, bool keepInMem)
+{
+	memset(&stats, 0, sizeof(CSVStats));
+	CSV_ERRORS error = resolveProjection();
+	if (error) return error;
+	if (!path) return CSV_BADFILENAME;
+
+// Get the size of the file
+	FILE * in = fopen(path, "rb");
+	if (!in) return CSV_FILEERROR;
+	fseek(in, 0, SEEK_END);
+	long long size = ftell(in);
+	fclose(in);
+
+// Load the whole file or a sample
+	bool sampling = sampleBytes > 0 && sampleBytes < size && !ramFile;
+	long long consumed = sampleBytes;
+	if (sampling) {
+		error = loadRange(0, sampleBytes, &consumed);
+		keepInMem = false;
+	}
+	if (!sampling || error == CSV_EOF) {
+	// Small compressed files are read whole
+		error = load();
+		sampling = false;
+	}
+	if (error) return error;
+	long long end = ramFileLen;
+	long long sampleLen = ramFileLen;
+	if (sampling) {
+	// Stop after the last complete line
+		if (end > sampleBytes) end = sampleBytes;
+		while (end > 0 && ramFile[end - 1] != '\r' && ramFile[end - 1] != '\n') end--;
+	}
+
+// Gather the statistics
+	error = assessChunks(stats, end, true);
+	if (!keepInMem) unload();
+	stats.noBytes = size;
+	if (sampling && end > 0) {
+	// Extrapolate the counts to the whole file
+		double scale = (double) size / consumed * sampleLen / end;
+		stats.noRows = (int) (stats.noRows * scale + 0.5);
+		stats.noComments = (int) (stats.noComments * scale + 0.5);
+		stats.noRaggedRows = (int) (stats.noRaggedRows * scale + 0.5);
+		stats.noEmptyCells = (long long) (stats.noEmptyCells * scale + 0.5);
+		stats.sampled = true;
+	}
+	return error;
+}
+
+CSV_ERRORS CSVFile::assessChunks(CSVStats & stats, long long end, bool detailed)
+{
+// Split the file, on several threads if allowed
+	CSV_PHASE(assessTime);
+	CSV_COUNT(assessBytes, end);
+	CSVChunk * chunks;
+	int noChunks = 1;
+	if (flags & CSV_PARALLEL) noChunks = splitChunks(chunks, end);
+	else{
+		chunks = (CSVChunk *) calloc(1, sizeof(CSVChunk));
+		if (chunks) chunks[0].end = end;
+	}
+	if (!chunks || !noChunks) return CSV_MEMORYERROR;
+	if (detailed) runParallel(noChunks, [&](int i) {statChunk(chunks[i]);});
+	else runParallel(noChunks, [&](int i) {countChunk(chunks[i]);});
+
+// Merge the counts
+	CSV_ERRORS error = CSV_NOERROR;
+	memset(&stats, 0, sizeof(CSVStats));
+	int maxFields = 0, noMaxFieldRows = 0;
+	long long noFilledCells = 0;
+	for (int i = 0; i < noChunks; i++) {
+		CSVChunk & chunk = chunks[i];
+		if (!error) error = chunk.error;
+		stats.noRows += chunk.noRows;
+		stats.noComments += chunk.noComments;
+		if (chunk.noColumns > stats.noColumns) stats.noColumns = chunk.noColumns;
+		if (chunk.noLineChars > stats.noLineChars) stats.noLineChars = chunk.noLineChars;
+		if (chunk.maxFields > maxFields) {
+			maxFields = chunk.maxFields;
+			noMaxFieldRows = 0;
+		}
+		if (chunk.maxFields == maxFields) noMaxFieldRows += chunk.noMaxFieldRows;
+		noFilledCells += chunk.noFilledCells;
+	}
+
+// Merge the widths
+	if (detailed) {
+		free(statWidths);
+		statWidths = (int *) calloc(stats.noColumns ? stats.noColumns : 1, sizeof(int));
+		if (!statWidths && !error) error = CSV_MEMORYERROR;
+		for (int i = 0; i < noChunks && statWidths; i++)
+			for (int c = 0; c < chunks[i].noWidths && c < stats.noColumns; c++)
+				if (chunks[i].widths[c] > statWidths[c]) statWidths[c] = chunks[i].widths[c];
+		stats.columnWidths = statWidths;
+		stats.noRaggedRows = stats.noRows - noMaxFieldRows;
+		stats.noEmptyCells = (long long) stats.noRows * stats.noColumns - noFilledCells;
+	}
+	for (int i = 0; i < noChunks; i++)
+		free(chunks[i].widths);
+	free(chunks);
+	return error;
+}
+
+/*****************************************************************************/
+/* Sidecar index: header, row offsets (noRows + 1) and comment offsets */
+struct CSVIndexHeader {
+	char magic[8];
+	long long sourceSize;
+	long long sourceTime;
+	unsigned long long sourceHash;
+	int noRows;
+	int noColumns;
+	int noComments;
+	char separator;
+	char rem;
+	char quote;
+	char padding[1];
+};
+
+static const char indexMagic[8] = {'C', 'S', 'V', 'I', 'D', 'X', '1', 0};
+static const int indexHashLen = 4096;
+
+static char * sidecarPath(const char * path, const char * suffix)
 {
-	if (!filename) return;
-	path = strdup(filename);
-	setEOL("\r\n");
+	char * sp = (char *) malloc(strlen(path) + strlen(suffix) + 1);
+	if (sp) sprintf(sp, "%s%s", path, suffix);
+	return sp;
 }
 
-CSVFile::CSVFile(int noRows, int noColumns, int noComments) :
-	file(NULL), path(NULL),
-	ramFile(NULL), ramFileLen(0),
-	rows(NULL), comments(NULL),
-	separator(';'), rem('#'), substitute(':'),
-	noRows(0), noAllocatedRows(0),
-	noColumns(0), noAllocatedColumns(0),
-	noComments(0), noAllocatedComments(0)
+static unsigned long long hashBytes(unsigned long long hash, const char * data, size_t length)
 {
-// Pre-allocate memory
-	reallocate(noRows, noColumns, noComments);
-	setEOL("\r\n");
+// FNV-1a
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
 }
 
-CSVFile::~CSVFile()
+static bool stampSource(const char * path, CSVIndexHeader & header)
 {
-// Close file
-	unload();
-	if (file) fclose(file);
-	if (path) free(path);
+// Size and modification time
+	FILE * in = fopen(path, "rb");
+	if (!in) return false;
+	fseek(in, 0, SEEK_END);
+	header.sourceSize = ftell(in);
+	header.sourceTime = 0;
+#ifdef CSV_POSIX
+	struct stat st;
+	if (!stat(path, &st)) header.sourceTime = (long long) st.st_mtime;
+#endif
 
-// Clean-up content
-	freeContent();
-	for (int r = 0; r < noAllocatedRows; r++)
-		if (rows[r]) free(rows[r]);
-	if (rows) free(rows);
+// Hash of the first and last blocks
+	char block[indexHashLen];
+	unsigned long long hash = 14695981039346656037ULL;
+	fseek(in, 0, SEEK_SET);
+	hash = hashBytes(hash, block, fread(block, 1, indexHashLen, in));
+	if (header.sourceSize > indexHashLen) {
+		fseek(in, -indexHashLen, SEEK_END);
+		hash = hashBytes(hash, block, fread(block, 1, indexHashLen, in));
+	}
+	header.sourceHash = hash;
+	bool valid = !ferror(in);
+	fclose(in);
+	return valid;
 }
 
-/*****************************************************************************/
-CSV_ERRORS CSVFile::reallocate(int noRows, int noColumns, int noComments)
+CSV_ERRORS CSVFile::buildIndex()
 {
-// Allocate rows
-	if (noRows > noAllocatedRows) {
-	// Allocate more memory
-		int lastNoRows = noAllocatedRows;
-		noAllocatedRows = 0;
-		rows = (char ***) realloc(rows, sizeof(char *) * noRows);
-		if (!rows) return CSV_MEMORYERROR;
-		noAllocatedRows = noRows;
-		for (int r = lastNoRows; r < noRows; r++)
-			rows[r] = NULL;
-	}else{
-	// Clean-up memory
-		for (int r = noRows; r < this->noRows; r++) {
-			for (int c = 0; c < this->noColumns; c++) {
-				char * p = rows[r][c];
-				if (p) {free(p); rows[r][c] = NULL;}
-			}
-			free(rows[r]);
-		}
-	}
-	this->noRows = noRows;
+// Stamp the file, then load it (a buffer kept by read() may be older)
+	if (!path) return CSV_BADFILENAME;
+	CSVIndexHeader header;
+	memset(&header, 0, sizeof(CSVIndexHeader));
+	memcpy(header.magic, indexMagic, sizeof(indexMagic));
+	header.separator = separator;
+	header.rem = rem;
+	header.quote = quote;
+	if (!stampSource(path, header)) return CSV_FILEERROR;
+	char * kept = ramFile;
+	long long keptLen = ramFileLen;
+	bool keptMapped = ramFileMapped;
+	ramFile = NULL;
+	ramFileLen = 0;
+	ramFileMapped = false;
+	CSV_ERRORS error = load();
 
-// Allocate columns
-	if (noColumns > noAllocatedColumns) {
-	// Allocate more memory
-		int lastNoColumns = noAllocatedColumns;
-		noAllocatedColumns = 0;
-		for (int r = 0; r < noRows; r++) {
-			rows[r] = (char **) realloc(rows[r], sizeof(char *) * noColumns);
-			if (!rows[r]) return CSV_MEMORYERROR;
-			for (int c = lastNoColumns; c < noColumns; c++)
-				rows[r][c] = NULL;
+// Record the offsets of the rows and comments
+	long long * offsets = NULL;
+	int noOffsets = 0, noAllocatedOffsets = 0;
+	long long * commentOffsets = NULL;
+	int noAllocatedComments = 0;
+	CSVSplitter splitter(ramFile, ramFileLen, separator, rem, quote, kernel);
+	long long lineStart = 0;
+	while (!error && splitter.split()) {
+		bool isRow = splitter.rowLine;
+		if (isRow && noOffsets + 1 >= noAllocatedOffsets) {
+			noAllocatedOffsets = noAllocatedOffsets ? noAllocatedOffsets * 2 : 1024;
+			long long * no = (long long *) realloc(offsets, sizeof(long long) * noAllocatedOffsets);
+			if (!no) {error = CSV_MEMORYERROR; break;}
+			offsets = no;
 		}
-		noAllocatedColumns = noColumns;
-	}else{
-	// Clean-up memory
-		for (int r = 0; r < this->noRows; r++)
-			for (int c = noColumns; c < this->noColumns; c++) {
-				char * p = rows[r][c];
-				if (p) {free(p); rows[r][c] = NULL;}
-			}
+		if (splitter.commentOnLine && header.noComments >= noAllocatedComments) {
+			noAllocatedComments = noAllocatedComments ? noAllocatedComments * 2 : 64;
+			long long * nc = (long long *) realloc(commentOffsets, sizeof(long long) * noAllocatedComments);
+			if (!nc) {error = CSV_MEMORYERROR; break;}
+			commentOffsets = nc;
+		}
+		if (isRow) {
+			offsets[noOffsets++] = lineStart;
+			offsets[noOffsets] = splitter.lineStart;
+		}
+		if (splitter.commentOnLine) commentOffsets[header.noComments++] = lineStart;
+		if (splitter.noFields > header.noColumns) header.noColumns = splitter.noFields;
+		lineStart = splitter.lineStart;
 	}
-	this->noColumns = noColumns;
+	if (!error) error = splitter.error;
+	unload();
+	ramFile = kept;
+	ramFileLen = keptLen;
+	ramFileMapped = keptMapped;
+	header.noRows = noOffsets;
 
-// Allocate comments
-	if (noComments > noAllocatedComments) {
-	// Allocate more memory
-		int lastNoComments = noAllocatedComments;
-		noAllocatedComments = 0;
-		comments = (char **) realloc(comments, sizeof(char *) * noComments);
-		if (!comments) return CSV_MEMORYERROR;
-		noAllocatedComments = noComments;
-		for (int c = lastNoComments; c < noComments; c++)
-			comments[c] = NULL;
-	}else{
-	// Clean-up memory
-		for (int c = noComments; c < this->noComments; c++) {
-			char * p = comments[c];
-			if (p) {free(p); comments[c] = NULL;}
-		}
+// Write the index, then replace the previous one
+	char * ip = sidecarPath(path, ".idx");
+	char * tmp = ip ? (char *) malloc(strlen(ip) + 5) : NULL;
+	if (!tmp) error = CSV_MEMORYERROR;
+	if (!error) {
+		sprintf(tmp, "%s.tmp", ip);
+		FILE * out = fopen(tmp, "wb");
+		if (out) {
+			long long end = 0;
+			fwrite(&header, sizeof(CSVIndexHeader), 1, out);
+			if (noOffsets) fwrite(offsets, sizeof(long long), noOffsets + 1, out);
+			else fwrite(&end, sizeof(long long), 1, out);
+			if (header.noComments) fwrite(commentOffsets, sizeof(long long), header.noComments, out);
+			if (ferror(out)) error = CSV_FILEERROR;
+			if (fclose(out)) error = CSV_FILEERROR;
+			if (!error && rename(tmp, ip)) error = CSV_FILEERROR;
+			if (error) remove(tmp);
+		}else error = CSV_FILEERROR;
 	}
-	this->noComments = noComments;
-	return CSV_NOERROR;
+	free(tmp);
+	free(ip);
+	free(offsets);
+	free(commentOffsets);
+	return error;
 }
 
-void CSVFile::freeContent()
+CSV_ERRORS CSVFile::checkIndex(FILE * & index, CSVIndexHeader & header)
 {
-// Free cells
-	for (int r = 0; r < noAllocatedRows; r++) {
-		for (int c = 0; c < noAllocatedColumns; c++) {
-			char * p = rows[r][c];
-			if (p) {free(p); rows[r][c] = NULL;}
+	if (!path) return CSV_BADFILENAME;
+	char * ip = sidecarPath(path, ".idx");
+	if (!ip) return CSV_MEMORYERROR;
+	for (int attempt = 0; attempt < 2; attempt++) {
+	// Compare the index with the file
+		CSVIndexHeader source;
+		if (!stampSource(path, source)) break;
+		index = fopen(ip, "rb");
+		if (index && fread(&header, sizeof(CSVIndexHeader), 1, index) == 1
+			&& !memcmp(header.magic, indexMagic, sizeof(indexMagic))
+			&& header.sourceSize == source.sourceSize && header.sourceTime == source.sourceTime
+			&& header.sourceHash == source.sourceHash
+			&& header.separator == separator && header.rem == rem && header.quote == quote) {
+			free(ip);
+			return CSV_NOERROR;
+		}
+	// Rebuild a missing or stale index
+		if (index) fclose(index);
+		index = NULL;
+		CSV_ERRORS error = buildIndex();
+		if (error) {
+			free(ip);
+			return error;
 		}
 	}
-// Free comments
-	for (int c = 0; c < noAllocatedComments; c++) {
-		char * p = comments[c];
-		if (p) {free(p); comments[c] = NULL;}
-	}
+	free(ip);
+	return CSV_FILEERROR;
 }
 
-/*****************************************************************************/
-void CSVFile::secureString(char * string)
+CSV_ERRORS CSVFile::openIndex(int & countRows, int & countColumns, int & countComments)
 {
-	if (!string) return;
-// Substitute characters used to format
-	int c;
-	while((c = *string++)) {
-		if ((c < ' ' && c != '\t') || (c == separator) || (c == rem))
-			string[-1] = substitute;
-	}
+	FILE * index;
+	CSVIndexHeader header;
+	CSV_ERRORS error = checkIndex(index, header);
+	if (error) return error;
+	fclose(index);
+	countRows = header.noRows;
+	countColumns = header.noColumns;
+	countComments = header.noComments;
+	return CSV_NOERROR;
 }
 
-/*****************************************************************************/
-CSV_ERRORS CSVFile::read(bool keepInMem)
+CSV_ERRORS CSVFile::readRows(int first, int count)
 {
-// Allocate memory
-	int countRows;
-	int countColumns;
-	int countComments;
-	int countLineChars;
-	CSV_ERRORS error = assess(countRows, countColumns, countComments, countLineChars, true);
+// Release previous content
+	freeContent();
+	noRows = 0;
+	noColumns = 0;
+	noComments = 0;
+
+// Find the range in the index
+	FILE * index;
+	CSVIndexHeader header;
+	CSV_ERRORS error = resolveProjection();
+	if (!error) error = checkIndex(index, header);
 	if (error) return error;
-	error = reallocate(countRows, countColumns, countComments);
+	if (first < 0) first = 0;
+	if (first > header.noRows) first = header.noRows;
+	if (count > header.noRows - first) count = header.noRows - first;
+	if (count < 0) count = 0;
+	long long range[2] = {0, 0};
+	fseek(index, sizeof(CSVIndexHeader) + sizeof(long long) * first, SEEK_SET);
+	if (count && fread(&range[0], sizeof(long long), 1, index) != 1) error = CSV_FILEERROR;
+	fseek(index, sizeof(CSVIndexHeader) + sizeof(long long) * (first + count), SEEK_SET);
+	if (count && fread(&range[1], sizeof(long long), 1, index) != 1) error = CSV_FILEERROR;
+	fclose(index);
 	if (error) return error;
-	freeContent();
 
-// Allocate parsing buffers
-	if (!countRows || !countLineChars) return CSV_NOERROR;
-	char commentBuffer[8 + countLineChars];
-	char cellBuffer[8 + countLineChars];
-	int commentLength = 0;
-	int cellLength = 0;
+// Load the range only
+	unload();
+	CSVChunk chunk;
+	memset(&chunk, 0, sizeof(CSVChunk));
+	if (flags & CSV_MAPPED) {
+		error = load();
+		chunk.start = range[0];
+		chunk.end = range[1];
+		if (chunk.end > ramFileLen) error = CSV_EOF;
+	}else{
+		error = loadRange(range[0], range[1]);
+		chunk.end = ramFileLen;
+	}
 
-// Initialise the parser
-	int row = 0;
-	int column = 0;
-	int comment = 0;
-	bool commentOnLine = false;
+// Parse the rows
+	if (!error) error = reserve(count, projection ? noProjected : header.noColumns, 0, false);
+	if (!error) {
+		CSV_PHASE(parseTime);
+		parseChunk(chunk, true);
+		CSV_COUNT(parseBytes, chunk.end - chunk.start);
+		CSV_BLOCKS(chunk.arena);
+		arenaSplice(arena, chunk.arena);
+		error = chunk.error;
+		noRows = chunk.noRows;
+		noColumns = count ? (projection ? noProjected : header.noColumns) : 0;
+		noComments = chunk.noComments;
+	}
 
-// Parse the file
-	for (long long k = 0; k < ramFileLen; k++) {
-		int c = ramFile[k];
-		if (c == '\r' || c == '\n') {
-		// New CSV line
-			if (commentOnLine) {
-				if (commentLength) {
-					commentBuffer[commentLength] = 0;
-					comments[comment++] = strdup(commentBuffer);
-					commentLength = 0;
-				}else comment++;
-			}
-			if (cellLength) {
-				cellBuffer[cellLength] = 0;
-				rows[row][column] = strdup(cellBuffer);
-				cellLength = 0;
-				column++;
-			}
-			if (column) row ++;
-			commentOnLine = false;
-			column = 0;
-		}else{
-		// Collect the data
-			if (commentOnLine) {
-				commentBuffer[commentLength++] = c;
-			}else{
-				if (c == rem) commentOnLine = true;
-				else if (c == separator) {
-					if (cellLength) {
-						cellBuffer[cellLength] = 0;
-						rows[row][column] = strdup(cellBuffer);
-						cellLength = 0;
-					}
-					column++;
-				}else{
-					cellBuffer[cellLength++] = c;
-				}
-			}
-		}
+// Hand the buffer over to the cells
+	if (flags & CSV_INSITU) {
+		contentFile = ramFile;
+		contentFileLen = ramFileLen;
+		contentFileMapped = ramFileMapped;
+		ramFile = NULL;
+		ramFileLen = 0;
+		ramFileMapped = false;
 	}
+	unload();
+	return error;
+}
 
-// Unload the file
-	if (!keepInMem) unload();
-	return CSV_NOERROR;
+/*****************************************************************************/
+/* Snapshot file: header, cell and comment offsets (-1 when empty) and
+   lengths, then the null terminated strings */
+struct CSVSnapshotHeader {
+	CSVIndexHeader source;
+	long long noBytes;
+};
+
+static const char snapshotMagic[8] = {'C', 'S', 'V', 'S', 'N', 'P', '1', 0};
+
+static bool snapshotString(const char * bytes, long long noBytes, long long offset, int length)
+{
+// Bound the string before reading its terminator
+	return offset < noBytes && length >= 0 && length < noBytes - offset && !bytes[offset + length];
 }
 
-CSV_ERRORS CSVFile::write()
+CSV_ERRORS CSVFile::saveSnapshot()
 {
-// Open the CSV file
+// Describe the table and the file
 	if (!path) return CSV_BADFILENAME;
-	file = fopen(path, "wb");
-	if (!file) return CSV_FILEERROR;
-	clearerr(file);
+	CSV_PHASE(writeTime);
+	if (projection || filter) return CSV_FORMATERROR;
+	CSVSnapshotHeader header;
+	memset(&header, 0, sizeof(CSVSnapshotHeader));
+	memcpy(header.source.magic, snapshotMagic, sizeof(snapshotMagic));
+	if (!stampSource(path, header.source)) return CSV_FILEERROR;
+	header.source.noRows = noRows;
+	header.source.noColumns = noColumns;
+	header.source.noComments = noComments;
+	header.source.separator = separator;
+	header.source.rem = rem;
+	header.source.quote = quote;
 
-// Write comments
-	for (int c = 0; c < noComments; c++) {
-		fwrite(&rem, 1, 1, file);
-		if (comments[c]) fwrite(comments[c], strlen(comments[c]), 1, file);
-		fwrite(eol, eolLen, 1, file);
+// Lay out the strings
+	long long noCells = (long long) noRows * noColumns + noComments;
+	long long * offsets = (long long *) malloc(sizeof(long long) * (noCells ? noCells : 1));
+	int * lengths = (int *) malloc(sizeof(int) * (noCells ? noCells : 1));
+	if (!offsets || !lengths) {
+		free(offsets);
+		free(lengths);
+		return CSV_MEMORYERROR;
 	}
-
-// Write rows
+	long long k = 0;
 	for (int r = 0; r < noRows; r++) {
-		for (int c = 0; c < noColumns; c++) {
-			if (rows[r][c])	fwrite(rows[r][c], strlen(rows[r][c]), 1, file);
-			if (c != noColumns - 1) fwrite(&separator, 1, 1, file);
+		CSVCell * row = cellRow(r);
+		for (int c = 0; c < noColumns; c++, k++) {
+			bool filled = row && row[c].data;
+			offsets[k] = filled ? header.noBytes : -1;
+			lengths[k] = filled ? row[c].length : 0;
+			if (filled) header.noBytes += row[c].length + 1;
 		}
-		fwrite(eol, eolLen, 1, file);
 	}
-
-// Detect any error
-	if (ferror(file)) {
-		fclose(file);
-		file = NULL;
-		return CSV_FILEERROR;
+	for (int c = 0; c < noComments; c++, k++) {
+		bool filled = comments[c].data != NULL;
+		offsets[k] = filled ? header.noBytes : -1;
+		lengths[k] = filled ? comments[c].length : 0;
+		if (filled) header.noBytes += comments[c].length + 1;
 	}
 
-// Close the CSV file
-	fclose(file);
-	file = NULL;
-	return CSV_NOERROR;
+// Write a temporary file, then replace the snapshot
+	char * sp = sidecarPath(path, ".snap");
+	char * tmp = sidecarPath(path, ".snap.tmp");
+	CSV_ERRORS error = sp && tmp ? CSV_NOERROR : CSV_MEMORYERROR;
+	CSVWriter writer;
+	if (!error) error = writer.open(tmp, 1 << 20, false, false);
+	if (!error) {
+		const char zero = 0;
+		writer.put((const char *) &header, sizeof(CSVSnapshotHeader));
+		for (long long k = 0; k < noCells; k += 1 << 16) {
+			int count = noCells - k < (1 << 16) ? (int) (noCells - k) : 1 << 16;
+			writer.put((const char *) &offsets[k], count * (int) sizeof(long long));
+		}
+		for (long long k = 0; k < noCells; k += 1 << 16) {
+			int count = noCells - k < (1 << 16) ? (int) (noCells - k) : 1 << 16;
+			writer.put((const char *) &lengths[k], count * (int) sizeof(int));
+		}
+		for (int r = 0; r < noRows; r++) {
+			CSVCell * row = cellRow(r);
+			for (int c = 0; c < noColumns; c++) {
+				if (!row || !row[c].data) continue;
+				writer.put(row[c].data, row[c].length);
+				writer.put(&zero, 1);
+			}
+		}
+		for (int c = 0; c < noComments; c++) {
+			if (!comments[c].data) continue;
+			writer.put(comments[c].data, comments[c].length);
+			writer.put(&zero, 1);
+		}
+		error = writer.close();
+		if (!error && rename(tmp, sp)) error = CSV_FILEERROR;
+	}
+	if (error && tmp) remove(tmp);
+	free(offsets);
+	free(lengths);
+	free(sp);
+	free(tmp);
+	return error;
 }
 
-/*****************************************************************************/
-CSV_ERRORS CSVFile::assess(int & countRows, int & countColumns, int & countComments, int & countLineChars, bool keepInMem)
+CSV_ERRORS CSVFile::loadSnapshot()
 {
-// Load the file
-	load();
+// Map the snapshot
+	if (!path) return CSV_BADFILENAME;
+	if (projection || filter) return CSV_FORMATERROR;
+	CSV_PHASE(loadTime);
+	CSVIndexHeader source;
+	if (!stampSource(path, source)) return CSV_FILEERROR;
+	char * sp = sidecarPath(path, ".snap");
+	if (!sp) return CSV_MEMORYERROR;
+	char * data = NULL;
+	long long length = 0;
+	bool mapped = false;
+	CSV_ERRORS error = mapPath(sp, data, length, mapped);
+	free(sp);
+	if (error) return error;
 
-// Count all elements
-	int cRow = 0;
-	int cColumn = 0;
-	int cColumnLocal = 0;
-	int cComment = 0;
-	int lastLine = 0;
-	int lineMaxLen = 0;
-	bool commentOnLine = false;
-	bool emptyLine = true;
-	for (long long k = 0; k < ramFileLen; k++) {
-		int c = ramFile[k];
-		if (c == '\r' || c == '\n') {
-		// Count rows and columns
-			if (!emptyLine) cRow ++;
-			if (++ cColumnLocal > cColumn)
-				cColumn = cColumnLocal;
-
-		// Count line length
-			lastLine = k - lastLine;
-			if (lastLine > lineMaxLen)
-				lineMaxLen = lastLine;
-			lastLine = k;
-
-		// Prepare next line
-			cColumnLocal = 0;
-			commentOnLine = false;
-			emptyLine = true;
-		}else if (c != ' ' || c != '\t') {
-		// Detect content
-			if (!commentOnLine) {
-				if (c == rem) {
-					commentOnLine = true;
-					cComment ++;
-				}else if (c == separator) {
-					cColumnLocal ++;
-					emptyLine = false;
-				}else emptyLine = false;
-			}
+// Compare the snapshot with the file
+	CSVSnapshotHeader header;
+	memset(&header, 0, sizeof(CSVSnapshotHeader));
+	if (length >= (long long) sizeof(CSVSnapshotHeader)) memcpy(&header, data, sizeof(CSVSnapshotHeader));
+	long long noCells = (long long) header.source.noRows * header.source.noColumns + header.source.noComments;
+	bool valid = !memcmp(header.source.magic, snapshotMagic, sizeof(snapshotMagic))
+		&& header.source.sourceSize == source.sourceSize && header.source.sourceTime == source.sourceTime
+		&& header.source.sourceHash == source.sourceHash
+		&& header.source.separator == separator && header.source.rem == rem && header.source.quote == quote
+		&& header.source.noRows >= 0 && header.source.noColumns >= 0 && header.source.noComments >= 0
+		&& header.noBytes >= 0 && header.noBytes <= length
+		&& noCells <= length / (long long) (sizeof(long long) + sizeof(int))
+		&& length == (long long) sizeof(CSVSnapshotHeader) + noCells * (long long) (sizeof(long long) + sizeof(int)) + header.noBytes;
+	if (!valid) {
+		releaseFile(data, length, mapped);
+		return CSV_FORMATERROR;
+	}
+
+// Point the cells into the snapshot
+	freeContent();
+	error = reallocate(header.source.noRows, header.source.noColumns, header.source.noComments);
+	const long long * offsets = (const long long *) &data[sizeof(CSVSnapshotHeader)];
+	const int * lengths = (const int *) &offsets[noCells];
+	const char * bytes = (const char *) &lengths[noCells];
+	long long k = 0;
+	for (int r = 0; r < noRows && !error; r++)
+		for (int c = 0; c < noColumns && !error; c++, k++) {
+			if (offsets[k] < 0) continue;
+			if (!snapshotString(bytes, header.noBytes, offsets[k], lengths[k])) {error = CSV_FORMATERROR; break;}
+			tableRow(r)[c].data = &bytes[offsets[k]];
+			tableRow(r)[c].length = lengths[k];
 		}
+	for (int c = 0; c < noComments && !error; c++, k++) {
+		if (offsets[k] < 0) continue;
+		if (!snapshotString(bytes, header.noBytes, offsets[k], lengths[k])) {error = CSV_FORMATERROR; break;}
+		comments[c].data = &bytes[offsets[k]];
+		comments[c].length = lengths[k];
 	}
 
-// Unload the file
-	if (!keepInMem) unload();
-	countRows = cRow;
-	countColumns = cColumn;
-	countComments = cComment;
-	countLineChars = lineMaxLen;
-	return CSV_NOERROR;
+// The snapshot is kept until the content is released
+	contentFile = data;
+	contentFileLen = length;
+	contentFileMapped = mapped;
+	if (error) {
+		freeContent();
+		reallocate(0, 0, 0);
+	}
+	return error;
 }
 
 /*****************************************************************************/
@@ -347,8 +3811,41 @@ CSV_ERRORS CSVFile::load()
 // Open the CSV file
 	if (ramFile) return CSV_NOERROR;
 	if (!path) return CSV_BADFILENAME;
-	file = fopen(path, "rb");
-	if (!file) return CSV_FILEERROR;
+	CSV_PHASE(loadTime);
+	CSVReader reader;
+	CSV_ERRORS error = reader.open(path);
+	if (error) return error;
+	if (reader.codec) {
+	// Decode compressed files block by block
+		long long capacity = 0;
+		while (!reader.end && !reader.error) {
+			if (ramFileLen == capacity) {
+				capacity = capacity ? capacity * 2 : 1 << 20;
+				char * nf = (char *) realloc(ramFile, capacity);
+				if (!nf) {
+					unload();
+					return CSV_MEMORYERROR;
+				}
+				ramFile = nf;
+				CSV_ALLOC(capacity);
+			}
+			ramFileLen += reader.read(&ramFile[ramFileLen], capacity - ramFileLen);
+		}
+		CSV_COUNT(loadBytes, ramFileLen);
+		CSV_PEAK(capacity);
+		if (reader.error) unload();
+		return reader.error;
+	}
+#ifdef CSV_POSIX
+	if (flags & CSV_MAPPED) {
+		CSV_ERRORS error = map();
+		CSV_COUNT(loadBytes, ramFileLen);
+		CSV_PEAK(ramFileLen);
+		return error;
+	}
+#endif
+	file = reader.file;
+	reader.file = NULL;
 
 // Allocate file buffer
 	fseek(file, 0, SEEK_END);
@@ -356,6 +3853,9 @@ CSV_ERRORS CSVFile::load()
 	ramFile = (char *) malloc(len);
 	if (!ramFile) return CSV_MEMORYERROR;
 	ramFileLen = len;
+	CSV_ALLOC(len);
+	CSV_PEAK(len);
+	CSV_COUNT(loadBytes, len);
 
 // Load complete file
 	fseek(file, 0, SEEK_SET);
@@ -375,12 +3875,59 @@ CSV_ERRORS CSVFile::load()
 	return CSV_NOERROR;
 }
 
+CSV_ERRORS CSVFile::map()
+{
+#ifdef CSV_POSIX
+	return mapPath(path, ramFile, ramFileLen, ramFileMapped);
+#else
+	return CSV_FILEERROR;
+#endif
+}
+
+CSV_ERRORS CSVFile::loadRange(long long start, long long end, long long * consumed)
+{
+// Open the CSV file
+	if (!path) return CSV_BADFILENAME;
+	CSV_PHASE(loadTime);
+	CSVReader reader;
+	CSV_ERRORS error = reader.open(path);
+	if (error) return error;
+
+// Load the bytes of the range
+	long long len = end - start;
+	ramFile = (char *) malloc(len ? len : 1);
+	if (!ramFile) return CSV_MEMORYERROR;
+	ramFileLen = len;
+	CSV_ALLOC(len);
+	CSV_PEAK(len);
+	CSV_COUNT(loadBytes, len);
+	if (!reader.codec) fseek(reader.file, start, SEEK_SET);
+	else{
+	// Compressed files are decoded up to the range
+		char * skip = (char *) malloc(readerBlock);
+		if (!skip) error = CSV_MEMORYERROR;
+		for (long long left = start; skip && left > 0; ) {
+			long long n = reader.read(skip, left < readerBlock ? left : readerBlock);
+			if (!n) break;
+			left -= n;
+		}
+		free(skip);
+	}
+	if (!error && len && reader.read(ramFile, len) != len) error = reader.error ? reader.error : CSV_EOF;
+	if (error) {
+		unload();
+		return error;
+	}
+	if (consumed) *consumed = reader.consumed();
+	return CSV_NOERROR;
+}
+
 void CSVFile::unload()
 {
-	if (!ramFile) return;
-	free(ramFile);
+	releaseFile(ramFile, ramFileLen, ramFileMapped);
 	ramFile = NULL;
 	ramFileLen = 0;
+	ramFileMapped = false;
 }
 
 /*****************************************************************************/
@@ -391,6 +3938,11 @@ void CSVFile::setFilename(const char * filename)
 	if (filename) path = strdup(filename);
 }
 
+int CSVFile::getKernel()
+{
+	return bestKernel(kernel);
+}
+
 void CSVFile::setEOL(const char * eol)
 {
 	strncpy(this->eol, eol, 4);
@@ -398,20 +3950,124 @@ void CSVFile::setEOL(const char * eol)
 	eolLen = strlen(this->eol);
 }
 
+/*****************************************************************************/
+void CSVFile::setProjection(const int * columns, int noColumns)
+{
+	clearProjection();
+	if (!columns || noColumns < 1) return;
+	projection = (int *) malloc(sizeof(int) * noColumns);
+	if (!projection) return;
+	memcpy(projection, columns, sizeof(int) * noColumns);
+	noProjected = noColumns;
+}
+
+void CSVFile::setProjectionNames(const char * const * names, int noNames)
+{
+	clearProjection();
+	if (!names || noNames < 1) return;
+	projection = (int *) malloc(sizeof(int) * noNames);
+	projectionNames = (char **) calloc(noNames, sizeof(char *));
+	if (!projection || !projectionNames) {
+		clearProjection();
+		return;
+	}
+	noProjected = noNames;
+	for (int n = 0; n < noNames; n++) {
+		projection[n] = -1;
+		projectionNames[n] = strdup(names[n] ? names[n] : "");
+		if (!projectionNames[n]) {
+			clearProjection();
+			return;
+		}
+	}
+}
+
+void CSVFile::clearProjection()
+{
+	if (projectionNames) {
+		for (int n = 0; n < noProjected; n++)
+			free(projectionNames[n]);
+		free(projectionNames);
+	}
+	if (projection) free(projection);
+	projection = NULL;
+	projectionNames = NULL;
+	noProjected = 0;
+}
+
+/*****************************************************************************/
+void CSVFile::setFilter(int column, const char * text, bool prefix)
+{
+	clearFilter();
+	if (column < 0 || !text) return;
+	filter = (CSVFilter *) calloc(1, sizeof(CSVFilter));
+	if (!filter) return;
+	filter->type = prefix ? CSV_FILTER_PREFIX : CSV_FILTER_EQUAL;
+	filter->column = column;
+	filter->text = strdup(text);
+	filter->length = strlen(text);
+	if (!filter->text) clearFilter();
+}
+
+void CSVFile::setFilter(int column, double min, double max)
+{
+	clearFilter();
+	if (column < 0) return;
+	filter = (CSVFilter *) calloc(1, sizeof(CSVFilter));
+	if (!filter) return;
+	filter->type = CSV_FILTER_RANGE;
+	filter->column = column;
+	filter->min = min;
+	filter->max = max;
+}
+
+void CSVFile::setFilter(int column, CSVFieldFilter test, void * user)
+{
+	clearFilter();
+	if (column < 0 || !test) return;
+	filter = (CSVFilter *) calloc(1, sizeof(CSVFilter));
+	if (!filter) return;
+	filter->type = CSV_FILTER_CALLBACK;
+	filter->column = column;
+	filter->test = test;
+	filter->user = user;
+}
+
+void CSVFile::clearFilter()
+{
+	if (!filter) return;
+	if (filter->text) free(filter->text);
+	free(filter);
+	filter = NULL;
+}
+
 /*****************************************************************************/
 void CSVFile::setComment(int index, const char * comment)
 {
 	if (index < 0 || index >= noComments) return;
-	if (comments[index]) free(comments[index]);
-	char * ns = strdup(comment);
+	if (unshare()) return;
+	comments[index].data = NULL;
+	if (!comment) return;
+	int length = strlen(comment);
+	char * ns = allocString(comment, length);
 	secureString(ns);
-	comments[index] = ns;
+	comments[index].data = ns;
+	comments[index].length = length;
+	comments[index].view = false;
 }
 
 const char * CSVFile::getComment(int index)
 {
 	if (index < 0 || index >= noComments) return NULL;
-	return comments[index];
+	CSVCell & cell = comments[index];
+	if (cell.view) {
+	// Materialize a view of a mapped file
+		char * ns = allocString(cell.data, cell.length);
+		if (!ns) return NULL;
+		cell.data = ns;
+		cell.view = false;
+	}
+	return cell.data;
 }
 
 /*****************************************************************************/
@@ -419,16 +4075,196 @@ const char * CSVFile::getCell(int row, int column)
 {
 	if (row < 0 || row >= noRows) return NULL;
 	if (column < 0 || column >= noColumns) return NULL;
-	return rows[row][column];
+	CSVCell * cells = cellRow(row);
+	if (!cells) return NULL;
+	CSVCell & cell = cells[column];
+	if (cell.view) {
+	// Materialize a view of a mapped file
+		char * ns = allocString(cell.data, cell.length);
+		if (!ns) return NULL;
+		cell.data = ns;
+		cell.view = false;
+	}
+	return cell.data;
+}
+
+CSVView CSVFile::getCellView(int row, int column)
+{
+	CSVView view = {NULL, 0};
+	if (row < 0 || row >= noRows) return view;
+	if (column < 0 || column >= noColumns) return view;
+	CSVCell * cells = cellRow(row);
+	if (!cells) return view;
+	view.data = cells[column].data;
+	view.length = cells[column].length;
+	return view;
 }
 
 void CSVFile::setCell(int row, int column, const char * data)
 {
 	if (row < 0 || row >= noRows) return;
 	if (column < 0 || column >= noColumns) return;
-	if (rows[row][column]) free(rows[row][column]);
-	char * ns = strdup(data);
-	secureString(ns);
-	rows[row][column] = ns;
+	if (lazy) return;
+	if (!data) {
+		if (unshare()) return;
+		dropColumns();
+		tableRow(row)[column].data = NULL;
+		return;
+	}
+	setCellString(row, column, data, strlen(data));
+}
+
+void CSVFile::setCellString(int row, int column, const char * data, int length)
+{
+	if (lazy || unshare()) return;
+	dropColumns();
+	char * ns = allocString(data, length);
+	if (!quote) secureString(ns);
+	CSVCell & cell = tableRow(row)[column];
+	cell.data = ns;
+	cell.length = ns ? length : 0;
+	cell.view = false;
+}
+
+/*****************************************************************************/
+bool CSVFile::getCellInt64(int row, int column, long long & value)
+{
+	if (row < 0 || row >= noRows) return false;
+	if (column < 0 || column >= noColumns) return false;
+	CSVCell * cells = cellRow(row);
+	if (!cells) return false;
+	CSVCell & cell = cells[column];
+	return parseInt64(cell.data, cell.data ? cell.length : 0, value);
+}
+
+bool CSVFile::getCellDouble(int row, int column, double & value)
+{
+	if (row < 0 || row >= noRows) return false;
+	if (column < 0 || column >= noColumns) return false;
+	CSVCell * cells = cellRow(row);
+	if (!cells) return false;
+	CSVCell & cell = cells[column];
+	return parseDouble(cell.data, cell.data ? cell.length : 0, !cell.view, value);
+}
+
+void CSVFile::setCellInt64(int row, int column, long long value)
+{
+	if (row < 0 || row >= noRows) return;
+	if (column < 0 || column >= noColumns) return;
+	char number[32];
+	setCellString(row, column, number, formatInt64(number, value));
+}
+
+void CSVFile::setCellDouble(int row, int column, double value)
+{
+	if (row < 0 || row >= noRows) return;
+	if (column < 0 || column >= noColumns) return;
+	char number[32];
+	setCellString(row, column, number, formatDouble(number, value));
+}
+
+
+/*****************************************************************************/
+CSVColumnView CSVFile::getColumn(int column)
+{
+	CSVColumnView view = {NULL, NULL, 0};
+	if (column < 0 || column >= noColumns) return view;
+	if (!columns && (flags & CSV_COLUMNAR)) buildColumns();
+	if (!columns) return view;
+	view.bytes = columns[column].bytes;
+	view.offsets = columns[column].offsets;
+	view.noRows = noRows;
+	return view;
+}
+
+bool CSVFile::getCellData(int row, int column, const char * & data, int & length)
+{
+// Prefer the columnar store (always null terminated)
+	if (columns) {
+		const long long * offsets = columns[column].offsets;
+		data = &columns[column].bytes[offsets[row]];
+		length = (int) (offsets[row + 1] - offsets[row] - 1);
+		return true;
+	}
+	CSVCell * cells = cellRow(row);
+	data = cells ? cells[column].data : NULL;
+	length = data ? cells[column].length : 0;
+	return !cells || !cells[column].view;
+}
+
+int CSVFile::getColumnInt64(int column, long long * values, long long missing)
+{
+	if (column < 0 || column >= noColumns) return 0;
+	if (!columns && (flags & CSV_COLUMNAR)) buildColumns();
+// Convert the cells
+	int converted = 0;
+	for (int r = 0; r < noRows; r++) {
+		const char * data;
+		int length;
+		getCellData(r, column, data, length);
+		if (parseInt64(data, length, values[r])) converted++;
+		else values[r] = missing;
+	}
+	return converted;
+}
+
+int CSVFile::getColumnDouble(int column, double * values, double missing)
+{
+	if (column < 0 || column >= noColumns) return 0;
+	if (!columns && (flags & CSV_COLUMNAR)) buildColumns();
+// Convert the cells
+	int converted = 0;
+	for (int r = 0; r < noRows; r++) {
+		const char * data;
+		int length;
+		bool terminated = getCellData(r, column, data, length);
+		if (parseDouble(data, length, terminated, values[r])) converted++;
+		else values[r] = missing;
+	}
+	return converted;
+}
+
+/*****************************************************************************/
+CSVProfile CSVFile::getProfile()
+{
+	CSVProfile current = profile;
+	current.noRows = noRows;
+	current.noColumns = noColumns;
+	current.noComments = noComments;
+	return current;
 }
 
+void CSVFile::resetProfile()
+{
+	memset(&profile, 0, sizeof(CSVProfile));
+}
+
+static void dumpPhase(FILE * out, const char * name, double time, long long bytes)
+{
+	fprintf(out, "\t\"%s\": {\"seconds\": %.6f", name, time);
+	if (bytes >= 0) fprintf(out, ", \"bytes\": %lld, \"bytesPerSecond\": %.0f", bytes, time > 0.0 ? bytes / time : 0.0);
+	fprintf(out, "},\n");
+}
+
+CSV_ERRORS CSVFile::dumpProfile(FILE * out)
+{
+	if (!out) return CSV_FILEERROR;
+	CSVProfile current = getProfile();
+#ifdef CSV_STATS
+	fprintf(out, "{\n\t\"enabled\": true,\n");
+#else
+	fprintf(out, "{\n\t\"enabled\": false,\n");
+#endif
+	dumpPhase(out, "load", current.loadTime, current.loadBytes);
+	dumpPhase(out, "assess", current.assessTime, current.assessBytes);
+	dumpPhase(out, "parse", current.parseTime, current.parseBytes);
+	dumpPhase(out, "materialize", current.materializeTime, -1);
+	dumpPhase(out, "write", current.writeTime, current.writeBytes);
+	fprintf(out, "\t\"allocations\": %lld,\n", current.noAllocations);
+	fprintf(out, "\t\"allocatedBytes\": %lld,\n", current.allocatedBytes);
+	fprintf(out, "\t\"peakBuffer\": %lld,\n", current.peakBuffer);
+	fprintf(out, "\t\"rows\": %d,\n", current.noRows);
+	fprintf(out, "\t\"columns\": %d,\n", current.noColumns);
+	fprintf(out, "\t\"comments\": %d\n}\n", current.noComments);
+	return ferror(out) ? CSV_FILEERROR : CSV_NOERROR;
+}
@@ -36,6 +36,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+struct CSVCell;
+struct CSVBlock;
+struct CSVChunk;
+struct CSVWriter;
+struct CSVColumn;
+struct CSVFilter;
+struct CSVIndexHeader;
+struct CSVLazy;
+struct CSVStorage;
+struct CSVTables;
+struct CSVPublisher;
+
 /*****************************************************************************/
     /* Doxywizard specific */
     /**
@@ -61,8 +73,149 @@ typedef enum {
 	CSV_FILEERROR,		/** File could not be either read or written */
 	CSV_MEMORYERROR,	/** Memory could not be allocated */
 	CSV_EOF,			/** File is empty or too short */
+	CSV_FORMATERROR,	/** File layout does not match the table */
 }CSV_ERRORS;
 
+/**
+ * \enum CSV_FLAGS
+ * \brief Options controlling how files are parsed and written
+ */
+typedef enum {
+	CSV_DEFAULT = 0,		/** Assess the file, then parse it (two passes) */
+	CSV_SINGLEPASS = 0x01,	/** Parse the file in a single pass, growing the tables on the fly */
+	CSV_MAPPED = 0x02,		/** Memory-map the file instead of loading it in a buffer */
+	CSV_INSITU = 0x04,		/** Keep the cells in the file buffer instead of copying them */
+	CSV_PARALLEL = 0x08,	/** Parse chunks of the file on several threads */
+	CSV_DIRECTIO = 0x10,	/** Bypass the page cache when writing with a buffer (O_DIRECT) */
+	CSV_COLUMNAR = 0x20,	/** Also copy the cells column by column after parsing them in rows */
+	CSV_LAZY = 0x40,		/** Only locate the rows when reading, parse them on first access */
+	CSV_PIPELINED = 0x80,	/** Parse the file while a background thread reads it (single pass) */
+	CSV_SNAPSHOT = 0x100,	/** Reload the binary snapshot of the file when up to date, save it otherwise */
+}CSV_FLAGS;
+
+/**
+ * \enum CSV_KERNELS
+ * \brief Delimiter scanning kernels
+ */
+typedef enum {
+	CSV_KERNEL_AUTO = 0,	/** Fastest kernel supported by the processor */
+	CSV_KERNEL_SCALAR,		/** Portable byte per byte scanning */
+	CSV_KERNEL_SSE2,		/** 16 bytes per step (x86) */
+	CSV_KERNEL_AVX2,		/** 32 bytes per step (x86) */
+}CSV_KERNELS;
+
+/**
+ * \enum CSV_FILTERS
+ * \brief Tests applied on a field to keep or drop its row
+ */
+typedef enum {
+	CSV_FILTER_NONE = 0,	/** Keep all rows */
+	CSV_FILTER_EQUAL,		/** Field equals a string */
+	CSV_FILTER_PREFIX,		/** Field starts with a string */
+	CSV_FILTER_RANGE,		/** Field is a number within a range */
+	CSV_FILTER_CALLBACK,	/** Field is accepted by a user function */
+}CSV_FILTERS;
+
+/**
+ * \struct CSVView
+ * \brief Read-only view on a string, not necessarily null terminated
+ */
+typedef struct {
+	const char * data;	/** First character, or null if not set */
+	int length;			/** Number of characters */
+}CSVView;
+
+/**
+ * \struct CSVColumnView
+ * \brief Read-only view on a column of the columnar store
+ *
+ * The cells of a column are stored one after the other, each one null
+ * terminated: cell r starts at bytes + offsets[r] and has
+ * offsets[r + 1] - offsets[r] - 1 characters.
+ */
+typedef struct {
+	const char * bytes;			/** Characters of the cells, or null if not stored */
+	const long long * offsets;	/** Start of each cell, noRows + 1 entries */
+	int noRows;					/** Number of cells */
+}CSVColumnView;
+
+/**
+ * \struct CSVStats
+ * \brief Statistics gathered by assess()
+ */
+typedef struct {
+	long long noBytes;			/** Size of the file */
+	int noRows;					/** Number of rows */
+	int noColumns;				/** Number of columns */
+	int noComments;				/** Number of comments */
+	int noLineChars;			/** Maximum number of characters on a single line */
+	int noRaggedRows;			/** Rows with fewer fields than the widest row */
+	long long noEmptyCells;		/** Cells left empty, missing fields included */
+	const int * columnWidths;	/** Maximum width of each column, valid until the next assess() */
+	bool sampled;				/** Figures are estimated from the beginning of the file */
+}CSVStats;
+
+/**
+ * \struct CSVProfile
+ * \brief Time and memory spent by a CSV file, gathered in builds with CSV_STATS defined
+ *
+ * Phase times exclude the phases nested in them (the load done by assess()
+ * counts as load only). Reading overlapped with parsing counts as parsing.
+ */
+typedef struct {
+	double loadTime;			/** Seconds reading, mapping or decoding files */
+	double assessTime;			/** Seconds counting the rows, columns and comments */
+	double parseTime;			/** Seconds splitting lines and storing cells (streamed handlers included) */
+	double materializeTime;		/** Seconds building columns, lazy rows and clones */
+	double writeTime;			/** Seconds writing files and snapshots */
+	long long loadBytes;		/** Bytes read from files */
+	long long assessBytes;		/** Bytes counted */
+	long long parseBytes;		/** Bytes parsed */
+	long long writeBytes;		/** Bytes written to files */
+	long long noAllocations;	/** File buffers, tables, arena blocks and columns allocated */
+	long long allocatedBytes;	/** Size of these allocations */
+	long long peakBuffer;		/** Largest file, refill or write buffer */
+	int noRows;					/** Number of rows */
+	int noColumns;				/** Number of columns */
+	int noComments;				/** Number of comments */
+}CSVProfile;
+
+/**
+ * \typedef CSVRowHandler
+ * \brief Function receiving the rows of a streamed CSV file
+ *
+ * Views point in the refill buffer: they are not null terminated and only
+ * valid during the call. Empty fields have a zero length.
+ * \param[in] user user pointer given to stream()
+ * \param[in] row row index, as getCell() would see it after read()
+ * \param[in] fields views on the fields of the row
+ * \param[in] noFields number of fields on the row
+ * \return false to stop streaming
+ */
+typedef bool (* CSVRowHandler)(void * user, int row, const CSVView * fields, int noFields);
+
+/**
+ * \typedef CSVCommentHandler
+ * \brief Function receiving the comments of a streamed CSV file
+ * \param[in] user user pointer given to stream()
+ * \param[in] index comment index, as getComment() would see it after read()
+ * \param[in] comment view on the comment, with null data if empty
+ * \return false to stop streaming
+ */
+typedef bool (* CSVCommentHandler)(void * user, int index, CSVView comment);
+
+/**
+ * \typedef CSVFieldFilter
+ * \brief Function deciding whether a row is read, from one of its fields
+ *
+ * The view points in the file buffer: it is not null terminated. With
+ * CSV_PARALLEL, the function is called from several threads at once.
+ * \param[in] user user pointer given to setFilter()
+ * \param[in] field view on the field, with a zero length if empty or missing
+ * \return true to keep the row
+ */
+typedef bool (* CSVFieldFilter)(void * user, CSVView field);
+
 class CSVFile
 {
 public:
@@ -82,15 +235,59 @@ public:
 	 */
 	CSVFile(int noRows, int noColumns, int noComments);
 
+	/**
+	 * \fn CSVFile(const CSVFile & source)
+	 * \brief Clone a CSV file, sharing its content until either side writes
+	 *
+	 * The clone is cheap: cells, comments and the file buffer are shared,
+	 * and the tables are only copied by the first writer.
+	 * A clone can then be read on another thread while the source is edited.
+	 * Cloning modifies the source: its content is frozen and its next write
+	 * copies the tables. Clones of one source may be taken from several threads,
+	 * but not while the source is otherwise used.
+	 * Open files, appenders and columnar stores are not cloned.
+	 * getCloneError() tells whether the content could be shared.
+	 * \param[in] source CSV file to clone
+	 */
+	CSVFile(const CSVFile & source);
+
+	/**
+	 * \fn CSVFile(CSVFile && source)
+	 * \brief Move a CSV file, leaving the source empty
+	 * \param[in] source CSV file to move
+	 */
+	CSVFile(CSVFile && source);
+
+	/**
+	 * \fn CSVFile & operator=(CSVFile source)
+	 * \brief Replace the content by a clone or a moved CSV file
+	 * \param[in] source CSV file to clone or move
+	 * \return this CSV file
+	 */
+	CSVFile & operator=(CSVFile source);
+
 	/**
 	 * \fn ~CSVFile()
 	 * \brief Release a CSV file
 	 */
 	~CSVFile();
 
+	/**
+	 * \fn CSV_ERRORS getCloneError()
+	 * \brief Get the error of the constructor that cloned this CSV file
+	 *
+	 * The clone is left empty, with the source settings, when it failed.
+	 * \return CSV_MEMORYERROR if the content could not be shared, CSV_NOERROR otherwise
+	 */
+	CSV_ERRORS getCloneError() {return cloneError;}
+
 	/**
 	 * \fn CSV_ERRORS read(bool keepInMem = false)
 	 * \brief Read a CSV file from disk
+	 *
+	 * Files compressed with gzip or zstd, recognised by their first bytes,
+	 * are decoded while loading in builds with CSV_ZLIB or CSV_ZSTD defined.
+	 * Other builds fail on them with CSV_FORMATERROR.
 	 * \param[in] keepInMem preserve file content in memory for further accesses
 	 * \return first error occured while reading
 	 */
@@ -99,10 +296,95 @@ public:
 	/**
 	 * \fn CSV_ERRORS write()
 	 * \brief Write a CSV file to disk
+	 *
+	 * Files named *.gz or *.zst are compressed while written (see read()).
+	 * With CSV_PARALLEL, zstd compresses on several threads.
 	 * \return first error occured while reading
 	 */
 	CSV_ERRORS write();
 
+	/**
+	 * \fn CSV_ERRORS append()
+	 * \brief Append the comments and rows to the end of the CSV file
+	 *
+	 * The existing content is not loaded: only its first row is read to check
+	 * that it has the same number of columns. A missing end-of-line on the
+	 * last line is added first. The file is created if it does not exist.
+	 * \return first error occured while writing, CSV_FORMATERROR if the file does not match
+	 */
+	CSV_ERRORS append();
+
+	/**
+	 * \fn CSV_ERRORS openAppend(int noColumns)
+	 * \brief Open the CSV file as a sink for rows given one by one
+	 *
+	 * Rows are formatted in a buffer of getWriteBuffer() bytes (64 KB if not
+	 * set) which is written when full, on flushAppend() and on closeAppend().
+	 * \param[in] noColumns number of columns of the appended rows
+	 * \return first error occured while opening, CSV_FORMATERROR if the file does not match
+	 */
+	CSV_ERRORS openAppend(int noColumns);
+
+	/**
+	 * \fn CSV_ERRORS appendRow(const char * const * fields, int noFields)
+	 * \brief Append a row to the sink opened by openAppend()
+	 *
+	 * Missing fields are left empty, formatting characters are substituted or
+	 * quoted as with setCell().
+	 * \param[in] fields strings of the row, null for empty fields
+	 * \param[in] noFields number of strings, at most the sink's number of columns
+	 * \return first error occured while writing
+	 */
+	CSV_ERRORS appendRow(const char * const * fields, int noFields);
+
+	/**
+	 * \fn CSV_ERRORS appendComment(const char * comment)
+	 * \brief Append a comment line to the sink opened by openAppend()
+	 * \param[in] comment comment string
+	 * \return first error occured while writing
+	 */
+	CSV_ERRORS appendComment(const char * comment);
+
+	/**
+	 * \fn CSV_ERRORS appendRow(const double * values, int noValues)
+	 * \brief Append a row of numbers to the sink opened by openAppend()
+	 *
+	 * Numbers are written with the fewest digits that read back exactly.
+	 * \param[in] values numbers of the row
+	 * \param[in] noValues number of values, at most the sink's number of columns
+	 * \return first error occured while writing
+	 */
+	CSV_ERRORS appendRow(const double * values, int noValues);
+
+	/**
+	 * \fn CSV_ERRORS flushAppend()
+	 * \brief Write the rows buffered by the sink to the CSV file
+	 * \return first error occured while writing
+	 */
+	CSV_ERRORS flushAppend();
+
+	/**
+	 * \fn CSV_ERRORS closeAppend()
+	 * \brief Flush and close the sink opened by openAppend()
+	 * \return first error occured while writing
+	 */
+	CSV_ERRORS closeAppend();
+
+	/**
+	 * \fn CSV_ERRORS stream(CSVRowHandler onRow, void * user, int bufferSize = 65536, CSVCommentHandler onComment = NULL)
+	 * \brief Read a CSV file row by row without storing it
+	 *
+	 * The file is read through a buffer of fixed size, only grown for lines
+	 * longer than the buffer. Compressed files are decoded block by block
+	 * into the buffer. Tables of the CSV file are left untouched.
+	 * \param[in] onRow function called for each row
+	 * \param[in] user user pointer passed to the handlers
+	 * \param[in] bufferSize size of the refill buffer in bytes
+	 * \param[in] onComment function called for each comment (optional)
+	 * \return first error occured while reading
+	 */
+	CSV_ERRORS stream(CSVRowHandler onRow, void * user, int bufferSize = 65536, CSVCommentHandler onComment = NULL);
+
 	/**
 	 * \fn CSV_ERRORS assess(int & countRows, int & countColumns, int & countComments, int & countLineChars, bool keepInMem = false)
 	 * \brief Get usefull statistics about a CSV file without parsing it totally
@@ -115,6 +397,130 @@ public:
 	 */
 	CSV_ERRORS assess(int & countRows, int & countColumns, int & countComments, int & countLineChars, bool keepInMem = false);
 
+	/**
+	 * \fn CSV_ERRORS assess(CSVStats & stats, long long sampleBytes = 0, bool keepInMem = false)
+	 * \brief Get detailed statistics about a CSV file without storing it
+	 *
+	 * With CSV_PARALLEL, chunks of the file are assessed on several threads.
+	 * With a sample size, only the beginning of the file is read: counts are
+	 * extrapolated to the size of the file, widths are those of the sample.
+	 * \param[out] stats statistics of the file
+	 * \param[in] sampleBytes number of bytes to sample, 0 for the whole file
+	 * \param[in] keepInMem preserve file content in memory for further accesses (not when sampling)
+	 * \return first error occured while reading
+	 */
+	CSV_ERRORS assess(CSVStats & stats, long long sampleBytes = 0, bool keepInMem = false);
+
+	/**
+	 * \fn CSV_ERRORS buildIndex()
+	 * \brief Save the row offsets of the CSV file in a sidecar index file
+	 *
+	 * The index is written next to the file with an ".idx" suffix. It holds
+	 * the offset of every row and comment line, the number of columns, and
+	 * the size, modification time and a hash of the start and end of the
+	 * file to detect changes. The file is loaded again even if read() kept
+	 * it in memory, as it may have changed since.
+	 * \return first error occured while indexing
+	 */
+	CSV_ERRORS buildIndex();
+
+	/**
+	 * \fn CSV_ERRORS openIndex(int & countRows, int & countColumns, int & countComments)
+	 * \brief Get the statistics of the CSV file from its index
+	 *
+	 * The index is rebuilt if it is missing or does not match the file.
+	 * \param[out] countRows number of rows
+	 * \param[out] countColumns number of columns
+	 * \param[out] countComments number of comments
+	 * \return first error occured while reading or rebuilding the index
+	 */
+	CSV_ERRORS openIndex(int & countRows, int & countColumns, int & countComments);
+
+	/**
+	 * \fn CSV_ERRORS readRows(int first, int count)
+	 * \brief Read a range of rows using the index, without scanning the file
+	 *
+	 * Only the bytes of the range are loaded (or touched, with CSV_MAPPED).
+	 * The rows are stored from row 0, along with the comments found between
+	 * them. The index is rebuilt if it is missing or does not match the file.
+	 * \param[in] first index of the first row in the file
+	 * \param[in] count number of rows, clipped to the end of the file
+	 * \return first error occured while reading
+	 */
+	CSV_ERRORS readRows(int first, int count);
+
+	/**
+	 * \fn CSV_ERRORS saveSnapshot()
+	 * \brief Save the parsed table in a binary snapshot next to the CSV file
+	 *
+	 * The snapshot is written with a ".snap" suffix. It holds the counts, an
+	 * offset and a length per cell and comment, and the null terminated
+	 * strings one after the other. Like the index, it records the size,
+	 * modification time and a hash of the file to detect changes. Tables
+	 * read with a projection or a filter are not saved. With CSV_SNAPSHOT,
+	 * read() only saves the tables it parsed from a new load of the file,
+	 * not from a buffer kept by read(true).
+	 * \return first error occured while writing, CSV_FORMATERROR for partial tables
+	 */
+	CSV_ERRORS saveSnapshot();
+
+	/**
+	 * \fn CSV_ERRORS loadSnapshot()
+	 * \brief Replace the table by the binary snapshot of the CSV file
+	 *
+	 * The snapshot is memory-mapped and the cells point into it: only the
+	 * rows are allocated. It is not loaded when it does not match the file,
+	 * or when a string runs past its null terminator.
+	 * \return first error occured while loading, CSV_FORMATERROR if the snapshot is stale
+	 */
+	CSV_ERRORS loadSnapshot();
+
+	/**
+	 * \fn CSV_ERRORS publish()
+	 * \brief Publish the current content as an immutable version for readers
+	 *
+	 * The version is a clone (see CSVFile(const CSVFile &)), swapped in
+	 * atomically: readers see either the previous version or this one.
+	 * Versions replaced earlier are freed once no reader can hold them,
+	 * with the strings only they still use.
+	 * Call it from the writer thread only, and once before the readers start.
+	 * Lazy tables can not be published.
+	 * \return first error occured while cloning (CSV_FORMATERROR for lazy tables)
+	 */
+	CSV_ERRORS publish();
+
+	/**
+	 * \fn int registerReader()
+	 * \brief Claim one of the 64 reader slots for a reader thread
+	 * \return reader slot, or -1 if none is free or nothing was published
+	 */
+	int registerReader();
+
+	/**
+	 * \fn void unregisterReader(int reader)
+	 * \brief Give a reader slot back
+	 * \param[in] reader reader slot
+	 */
+	void unregisterReader(int reader);
+
+	/**
+	 * \fn CSVFile * beginRead(int reader)
+	 * \brief Pin the latest published version (wait-free)
+	 *
+	 * The version stays valid until endRead() is called with the same slot.
+	 * It must only be read (getters), never written to nor deleted.
+	 * \param[in] reader reader slot
+	 * \return pinned version
+	 */
+	CSVFile * beginRead(int reader);
+
+	/**
+	 * \fn void endRead(int reader)
+	 * \brief Unpin the version returned by beginRead()
+	 * \param[in] reader reader slot
+	 */
+	void endRead(int reader);
+
 	/**
 	 * \fn void setFilename(const char * filename)
 	 * \brief Set the CSV filename
@@ -180,6 +586,26 @@ public:
 	 */
 	char getRem() {return rem;}
 
+	/**
+	 * \fn void setQuote(char quote)
+	 * \brief Set the character used to quote the fields (default: 0, no quoting)
+	 *
+	 * Quoted fields may hold separators, comment characters and line ends, a
+	 * doubled quote within quotes stands for a quote (RFC 4180). Cells keep
+	 * their formatting characters and write() quotes the fields that need it.
+	 * Parallel and pipelined reads split the file at the line ends found
+	 * outside quotes, which costs one more scan of each chunk.
+	 * \param[in] quote quote character, usually '"', 0 to disable quoting
+	 */
+	void setQuote(char quote) {this->quote = quote;}
+
+	/**
+	 * \fn char getQuote()
+	 * \brief Get the character used to quote the fields
+	 * \return quote character, 0 if disabled
+	 */
+	char getQuote() {return quote;}
+
 	/**
 	 * \fn void setEOL(const char * eol);
 	 * \brief Set the string used to indicate a newline (default: '\r\n')
@@ -194,6 +620,167 @@ public:
 	 */
 	const char * getEOL() { return eol;}
 
+	/**
+	 * \fn void setFlags(int flags)
+	 * \brief Set the options used to parse the file (default: CSV_DEFAULT)
+	 * \param[in] flags combination of CSV_FLAGS
+	 */
+	void setFlags(int flags) {this->flags = flags;}
+
+	/**
+	 * \fn int getFlags()
+	 * \brief Get the options used to parse the file
+	 * \return combination of CSV_FLAGS
+	 */
+	int getFlags() {return flags;}
+
+	/**
+	 * \fn void setKernel(int kernel)
+	 * \brief Select the delimiter scanning kernel (default: CSV_KERNEL_AUTO)
+	 * \param[in] kernel one of CSV_KERNELS, unsupported kernels fall back to the next best
+	 */
+	void setKernel(int kernel) {this->kernel = kernel;}
+
+	/**
+	 * \fn int getKernel()
+	 * \brief Get the delimiter scanning kernel actually used
+	 * \return one of CSV_KERNELS
+	 */
+	int getKernel();
+
+	/**
+	 * \fn void setThreads(int threads)
+	 * \brief Set the number of threads used by CSV_PARALLEL (default: 0, one per core)
+	 * \param[in] threads number of threads
+	 */
+	void setThreads(int threads) {this->threads = threads;}
+
+	/**
+	 * \fn int getThreads()
+	 * \brief Get the number of threads used by CSV_PARALLEL
+	 * \return number of threads, 0 for one per core
+	 */
+	int getThreads() {return threads;}
+
+	/**
+	 * \fn void setWriteBuffer(int size)
+	 * \brief Set the size of the output buffer used by write() (default: 0)
+	 *
+	 * With a buffer, rows are formatted in memory and written in large
+	 * blocks (whole 4 KB blocks with CSV_DIRECTIO). With 0, every field is
+	 * written on its own with fwrite().
+	 * \param[in] size buffer size in bytes
+	 */
+	void setWriteBuffer(int size) {writeBufferSize = size;}
+
+	/**
+	 * \fn int getWriteBuffer()
+	 * \brief Get the size of the output buffer used by write()
+	 * \return buffer size in bytes
+	 */
+	int getWriteBuffer() {return writeBufferSize;}
+
+	/**
+	 * \fn void setLazyCache(int rows)
+	 * \brief Set the number of rows kept parsed by CSV_LAZY (default: 1024)
+	 *
+	 * Least recently used rows are dropped first: strings returned by
+	 * getCell() stay valid until their row is dropped. Lazy tables can not be
+	 * modified with setCell().
+	 * \param[in] rows number of rows in the cache
+	 */
+	void setLazyCache(int rows) {lazyCacheRows = rows;}
+
+	/**
+	 * \fn int getLazyCache()
+	 * \brief Get the number of rows kept parsed by CSV_LAZY
+	 * \return number of rows in the cache
+	 */
+	int getLazyCache() {return lazyCacheRows;}
+
+	/**
+	 * \fn void setPipelineBlock(int size)
+	 * \brief Set the size of the blocks read ahead by CSV_PIPELINED (default: 4 MB)
+	 *
+	 * The I/O thread reads the next block while the lines of the previous
+	 * ones are parsed. CSV_MAPPED, CSV_PARALLEL and CSV_LAZY take precedence.
+	 * \param[in] size block size in bytes
+	 */
+	void setPipelineBlock(int size) {pipelineBlockSize = size;}
+
+	/**
+	 * \fn int getPipelineBlock()
+	 * \brief Get the size of the blocks read ahead by CSV_PIPELINED
+	 * \return block size in bytes
+	 */
+	int getPipelineBlock() {return pipelineBlockSize;}
+
+	/**
+	 * \fn void setProjection(const int * columns, int noColumns)
+	 * \brief Only read the given columns of the file
+	 *
+	 * read() then stores the fields of these columns in the given order and
+	 * skips the others without copying them; getNoColumns() and assess()
+	 * report the projected number of columns.
+	 * \param[in] columns indexes of the columns in the file
+	 * \param[in] noColumns number of indexes
+	 */
+	void setProjection(const int * columns, int noColumns);
+
+	/**
+	 * \fn void setProjectionNames(const char * const * names, int noNames)
+	 * \brief Only read the columns whose first row field matches the given names
+	 *
+	 * Names are looked up when reading, which fails with CSV_FORMATERROR if one
+	 * of them is missing. The first row is kept as the projected header.
+	 * \param[in] names header names of the columns
+	 * \param[in] noNames number of names
+	 */
+	void setProjectionNames(const char * const * names, int noNames);
+
+	/**
+	 * \fn void clearProjection()
+	 * \brief Read all columns of the file again
+	 */
+	void clearProjection();
+
+	/**
+	 * \fn void setFilter(int column, const char * text, bool prefix = false)
+	 * \brief Only read the rows whose field equals or starts with a string
+	 *
+	 * Rows are tested as soon as their line is split, before any cell is
+	 * stored; assess() counts the kept rows only. The first row is tested
+	 * like the others.
+	 * \param[in] column index of the tested column in the file
+	 * \param[in] text string to compare with
+	 * \param[in] prefix compare the beginning of the field only
+	 */
+	void setFilter(int column, const char * text, bool prefix = false);
+
+	/**
+	 * \fn void setFilter(int column, double min, double max)
+	 * \brief Only read the rows whose field is a number within [min, max]
+	 * \param[in] column index of the tested column in the file
+	 * \param[in] min lowest accepted value
+	 * \param[in] max highest accepted value
+	 */
+	void setFilter(int column, double min, double max);
+
+	/**
+	 * \fn void setFilter(int column, CSVFieldFilter test, void * user)
+	 * \brief Only read the rows whose field is accepted by a function
+	 * \param[in] column index of the tested column in the file
+	 * \param[in] test function called on the field of each row
+	 * \param[in] user user pointer passed to the function
+	 */
+	void setFilter(int column, CSVFieldFilter test, void * user);
+
+	/**
+	 * \fn void clearFilter()
+	 * \brief Read all rows of the file again
+	 */
+	void clearFilter();
+
 	/**
 	 * \fn int getNoRows()
 	 * \brief Get the number of rows in the CSV file
@@ -208,9 +795,31 @@ public:
 	 */
 	int getNoColumns() {return noColumns;}
 
+	/**
+	 * \fn CSV_ERRORS addRow()
+	 * \brief Add an empty row at the end of the table
+	 *
+	 * The capacity grows geometrically: adding rows one by one is linear.
+	 * \return CSV_MEMORYERROR if the table could not grow, CSV_FORMATERROR on lazy tables
+	 */
+	CSV_ERRORS addRow();
+
+	/**
+	 * \fn CSV_ERRORS addColumn()
+	 * \brief Add an empty column at the right of the table
+	 *
+	 * Only growing past the column capacity moves the cells.
+	 * \return CSV_MEMORYERROR if the table could not grow, CSV_FORMATERROR on lazy tables
+	 */
+	CSV_ERRORS addColumn();
+
 	/**
 	 * \fn void setCell(int row, int column, const char * data);
 	 * \brief Set the specified cell string (copy the string)
+	 *
+	 * Strings are stored in an arena owned by the CSV file: the memory of a
+	 * replaced cell is only reclaimed by the next read() or destruction.
+	 * Formatting characters are substituted unless quoting is set (setQuote()).
 	 * \param[in] row cell's row
 	 * \param[in] column cell's column
 	 * \param[in] data cell's string
@@ -222,34 +831,209 @@ public:
 	 * \brief Get the specified cell string
 	 * \param[in] row cell's row
 	 * \param[in] column cell's column
-	 * \return desired cell string or null if not set
+	 * \return desired cell string or null if not set (valid until the next read())
 	 */
 	const char * getCell(int row, int column);
 
+	/**
+	 * \fn CSVView getCellView(int row, int column)
+	 * \brief Get the specified cell string without copying it
+	 *
+	 * With CSV_INSITU | CSV_MAPPED, views point in the mapped file and are not
+	 * null terminated; getCell() copies them on first access.
+	 * \param[in] row cell's row
+	 * \param[in] column cell's column
+	 * \return view on the cell string, with null data if not set
+	 */
+	CSVView getCellView(int row, int column);
+
+	/**
+	 * \fn bool getCellInt64(int row, int column, long long & value)
+	 * \brief Convert the specified cell to an integer
+	 * \param[in] row cell's row
+	 * \param[in] column cell's column
+	 * \param[out] value converted integer, untouched on failure
+	 * \return true if the cell holds a valid integer
+	 */
+	bool getCellInt64(int row, int column, long long & value);
+
+	/**
+	 * \fn bool getCellDouble(int row, int column, double & value)
+	 * \brief Convert the specified cell to a floating point number
+	 *
+	 * Plain decimals with up to 15 significant digits are converted exactly
+	 * without the C library, other forms go through strtod().
+	 * \param[in] row cell's row
+	 * \param[in] column cell's column
+	 * \param[out] value converted number, untouched on failure
+	 * \return true if the cell holds a valid number
+	 */
+	bool getCellDouble(int row, int column, double & value);
+
+	/**
+	 * \fn void setCellInt64(int row, int column, long long value)
+	 * \brief Set the specified cell to an integer
+	 * \param[in] row cell's row
+	 * \param[in] column cell's column
+	 * \param[in] value cell's integer
+	 */
+	void setCellInt64(int row, int column, long long value);
+
+	/**
+	 * \fn void setCellDouble(int row, int column, double value)
+	 * \brief Set the specified cell to a floating point number
+	 *
+	 * The number is written with the fewest digits that read back exactly.
+	 * \param[in] row cell's row
+	 * \param[in] column cell's column
+	 * \param[in] value cell's number
+	 */
+	void setCellDouble(int row, int column, double value);
+
+	/**
+	 * \fn CSVColumnView getColumn(int column)
+	 * \brief Get a column of the columnar store
+	 *
+	 * The store is built by read() with CSV_COLUMNAR, and rebuilt on demand
+	 * after setCell() while the flag is set. It is a copy of the parsed rows,
+	 * which stay in memory: the cell strings are held twice.
+	 * \param[in] column desired column
+	 * \return view on the column, with null bytes if not stored
+	 */
+	CSVColumnView getColumn(int column);
+
+	/**
+	 * \fn int getColumnInt64(int column, long long * values, long long missing = 0)
+	 * \brief Convert a whole column to integers
+	 * \param[in] column desired column
+	 * \param[out] values array of getNoRows() integers
+	 * \param[in] missing value stored for empty or invalid cells
+	 * \return number of cells converted
+	 */
+	int getColumnInt64(int column, long long * values, long long missing = 0);
+
+	/**
+	 * \fn int getColumnDouble(int column, double * values, double missing = 0.0)
+	 * \brief Convert a whole column to floating point numbers
+	 * \param[in] column desired column
+	 * \param[out] values array of getNoRows() numbers
+	 * \param[in] missing value stored for empty or invalid cells
+	 * \return number of cells converted
+	 */
+	int getColumnDouble(int column, double * values, double missing = 0.0);
+
+	/**
+	 * \fn CSVProfile getProfile()
+	 * \brief Get the time and memory spent since the creation or the last reset
+	 *
+	 * Only the table counts are filled in builds without CSV_STATS, where
+	 * the instrumentation compiles to nothing.
+	 * \return profile of the CSV file
+	 */
+	CSVProfile getProfile();
+
+	/**
+	 * \fn void resetProfile()
+	 * \brief Restart the profile from zero
+	 */
+	void resetProfile();
+
+	/**
+	 * \fn CSV_ERRORS dumpProfile(FILE * out)
+	 * \brief Write the profile as a JSON object, with bytes per second of each phase
+	 * \param[in] out file to write to (stdout, stderr, opened file)
+	 * \return CSV_FILEERROR if the profile could not be written
+	 */
+	CSV_ERRORS dumpProfile(FILE * out);
+
 private:
 	FILE * file;
 	char * path;
 	char * ramFile;
 	long long ramFileLen;
+	bool ramFileMapped;
+	char * contentFile;
+	long long contentFileLen;
+	bool contentFileMapped;
 
-	char *** rows;
-	char ** comments;
+	CSVCell * matrix;
+	CSVCell * comments;
+	CSVBlock * arena;
+	CSVColumn * columns;
+	int noStoredColumns;
 	char separator;
 	char rem;
+	char quote;
 	char substitute;
 	char eol[4];
 	int eolLen;
+	int flags;
+	int kernel;
+	int threads;
+	int writeBufferSize;
+	CSVWriter * sink;
+	int sinkColumns;
+	int * projection;
+	char ** projectionNames;
+	int noProjected;
+	CSVFilter * filter;
+	CSVLazy * lazy;
+	int lazyCacheRows;
+	int * statWidths;
+	int pipelineBlockSize;
 	int noRows, noAllocatedRows;
 	int noColumns, noAllocatedColumns;
 	int noComments, noAllocatedComments;
+	CSVStorage * storage;
+	CSVTables * tables;
+	CSVPublisher * publisher;
+	CSVProfile profile;
+	CSV_ERRORS cloneError;
 
 private:
 	CSV_ERRORS load();
+	CSV_ERRORS map();
+	CSV_ERRORS loadRange(long long start, long long end, long long * consumed = NULL);
+	CSV_ERRORS checkIndex(FILE * & index, CSVIndexHeader & header);
 	void unload();
 
+	CSV_ERRORS resolveProjection();
+	CSV_ERRORS parse();
+	CSV_ERRORS parseLazy();
+	CSV_ERRORS parsePipelined();
+	CSVCell * lazyRow(int row);
+	CSVCell * tableRow(int row);
+	CSVCell * cellRow(int row);
+	void dropLazy();
+	CSV_ERRORS parseParallel();
+	bool keepRow(const CSVView * fields, int noFields);
+	void countChunk(CSVChunk & chunk);
+	void statChunk(CSVChunk & chunk);
+	int splitChunks(CSVChunk * & chunks, long long end);
+	CSV_ERRORS assessChunks(CSVStats & stats, long long end, bool detailed);
+	void parseChunk(CSVChunk & chunk, bool grow);
+	CSV_ERRORS writeBuffered();
+	void writeContent(CSVWriter & writer);
+	void writeSecure(CSVWriter & writer, const char * data, int length);
+	void writeField(CSVWriter & writer, const char * data, int length, bool alone);
+	CSV_ERRORS checkAppend(int noColumns, bool & needEOL);
+	CSV_ERRORS storeString(CSVCell & cell, const CSVView & text, bool transient, CSVBlock * & arena);
+
 	CSV_ERRORS reallocate(int noRows, int noColumns, int noComments);
+	CSV_ERRORS reserve(int noRows, int noColumns, int noComments, bool grow);
 	void freeContent();
+	void swap(CSVFile & other);
+	CSV_ERRORS share();
+	CSV_ERRORS lend(CSVFile & clone);
+	CSV_ERRORS compact();
+	CSV_ERRORS unshare();
+	void reclaim();
+	CSV_ERRORS buildColumns();
+	void dropColumns();
+	bool getCellData(int row, int column, const char * & data, int & length);
+	char * allocString(const char * data, int length);
 	void secureString(char * string);
+	void setCellString(int row, int column, const char * data, int length);
 
 };
 
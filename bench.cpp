@@ -0,0 +1,817 @@
+/*
+	Basic CSV file reader / writer class
+	Version 0.1, 06/01/2016
+	-> Crossplatform / standard ASCII support
+	-> bench.cpp
+
+	The MIT License (MIT)
+
+	Copyright (c) 2016 Frdric Meslin
+	Email: fredericmeslin@hotmail.com
+	Website: www.fredslab.net
+	Twitter: @marzacdev
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <atomic>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/resource.h>
+#endif
+
+#include "CSVFile.h"
+
+/*****************************************************************************/
+// Allocation counting (link with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc)
+static std::atomic<long long> noAllocs(0);
+
+#ifdef CSV_BENCH_ALLOCS
+extern "C" {
+	void * __real_malloc(size_t size);
+	void * __real_calloc(size_t count, size_t size);
+	void * __real_realloc(void * data, size_t size);
+	void * __wrap_malloc(size_t size) {noAllocs++; return __real_malloc(size);}
+	void * __wrap_calloc(size_t count, size_t size) {noAllocs++; return __real_calloc(count, size);}
+	void * __wrap_realloc(void * data, size_t size) {noAllocs++; return __real_realloc(data, size);}
+}
+#endif
+
+/*****************************************************************************/
+static bool machine = false;
+static const char * suite = "";
+static char readQuote = 0;
+
+static double now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static long long peakKB()
+{
+// Peak resident set size since the last mark, in kilobytes
+#ifdef __linux__
+	FILE * file = fopen("/proc/self/status", "r");
+	if (file) {
+		char line[256];
+		long long peak = -1;
+		while (fgets(line, sizeof(line), file))
+			if (strncmp(line, "VmHWM:", 6) == 0) peak = atoll(line + 6);
+		fclose(file);
+		if (peak >= 0) return peak;
+	}
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;
+	#else
+		return usage.ru_maxrss;
+	#endif
+#else
+	return 0;
+#endif
+}
+
+static double mark()
+{
+// Reset the peak and allocation counters, then start timing
+#ifdef __linux__
+	FILE * file = fopen("/proc/self/clear_refs", "w");
+	if (file) {
+		fputs("5", file);
+		fclose(file);
+	}
+#endif
+	noAllocs = 0;
+	return now();
+}
+
+static void section(const char * name, const char * title)
+{
+// Start a group of results
+	suite = name;
+	if (machine) printf("# %s\n", title);
+	else printf("Benchmarking %s\n", title);
+}
+
+static void report(const char * name, double seconds, long long bytes, const char * unit = NULL, double value = 0.0)
+{
+// Print one result, counters cover the last run since mark()
+	long long peak = peakKB();
+	long long allocs = noAllocs;
+	if (machine) {
+		printf("%s;%s;%.3f;", suite, name, seconds * 1e3);
+		if (bytes && seconds > 0) printf("%.2f", bytes / seconds / 1e6);
+		printf(";");
+		if (unit) printf("%.2f;%s", value, unit);
+		else printf(";");
+		printf(";%lli;%lli\n", peak, allocs);
+		return;
+	}
+	printf("%-16s", name);
+	if (seconds > 0) printf(" %10.3f ms", seconds * 1e3);
+	else printf(" %13s", "");
+	if (bytes && seconds > 0) printf(" %10.2f MB/s", bytes / seconds / 1e6);
+	else printf(" %15s", "");
+	if (unit) printf(" %10.2f %-7s", value, unit);
+	else printf(" %18s", "");
+	printf(" %8lli KB %10lli allocs\n", peak, allocs);
+}
+
+static long long fileLength(const char * path)
+{
+	FILE * file = fopen(path, "rb");
+	if (!file) return 0;
+	fseek(file, 0, SEEK_END);
+	long long len = ftell(file);
+	fclose(file);
+	return len;
+}
+
+/*****************************************************************************/
+static long long generate(const char * path, int noRows, int noColumns, int width = 0, int commentEvery = 1000, int quoted = 0, int ragged = 0)
+{
+// Write a synthetic CSV file (numbers, or text cells of the given width)
+// A percentage of the cells are quoted, a percentage of the rows are ragged
+	FILE * file = fopen(path, "wb");
+	if (!file) return 0;
+	srand(1234);
+	for (int r = 0; r < noRows; r++) {
+		if (commentEvery && r % commentEvery == 0) fprintf(file, "#Comment line %i\r\n", r);
+		int noFields = noColumns;
+		if (ragged && rand() % 100 < ragged) noFields = 1 + rand() % noColumns;
+		for (int c = 0; c < noFields; c++) {
+			bool quote = quoted && rand() % 100 < quoted;
+			if (quote) fputc('"', file);
+			if (!width) fprintf(file, "%i", rand());
+			else for (int k = 0; k < width; k++) fputc('a' + rand() % 26, file);
+			if (quote) fputc('"', file);
+			if (c != noFields - 1) fputc(';', file);
+		}
+		fputs("\r\n", file);
+	}
+	long long len = ftell(file);
+	fclose(file);
+	return len;
+}
+
+/*****************************************************************************/
+static void benchRead(const char * name, const char * path, long long len, int flags, int runs, const int * projection = NULL, int noProjected = 0)
+{
+// Time complete reads of the file
+	double best = 1e30;
+	for (int i = 0; i < runs; i++) {
+		CSVFile csv(path);
+		csv.setFlags(flags);
+		csv.setQuote(readQuote);
+		csv.setProjection(projection, noProjected);
+		double start = mark();
+		csv.read();
+		double elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	report(name, best, len);
+}
+
+static void benchAssess(const char * name, const char * path, long long len, int flags, bool detailed, long long sampleBytes, int runs)
+{
+// Time the statistics of the file, counts only or detailed
+	double best = 1e30;
+	for (int i = 0; i < runs; i++) {
+		CSVFile csv(path);
+		csv.setFlags(flags);
+		csv.setQuote(readQuote);
+		int countRows, countColumns, countComments, countLineChars;
+		CSVStats stats;
+		double start = mark();
+		if (detailed) csv.assess(stats, sampleBytes);
+		else csv.assess(countRows, countColumns, countComments, countLineChars);
+		double elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	report(name, best, len);
+}
+
+static void dropCache(const char * path)
+{
+// Evict the file from the page cache to time cold reads
+#ifdef POSIX_FADV_DONTNEED
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+#endif
+}
+
+static double coldRead(const char * path, int flags, int runs)
+{
+// Time reads of the file from a cold cache (flags < 0: load only)
+	double best = 1e30;
+	for (int i = 0; i < runs; i++) {
+		dropCache(path);
+		double start = mark();
+		if (flags < 0) {
+			FILE * file = fopen(path, "rb");
+			fseek(file, 0, SEEK_END);
+			long len = ftell(file);
+			fseek(file, 0, SEEK_SET);
+			char * buffer = (char *) malloc(len ? len : 1);
+			if (fread(buffer, len, 1, file) != 1) len = 0;
+			fclose(file);
+			free(buffer);
+		}else{
+			CSVFile csv(path);
+			csv.setFlags(flags);
+			csv.read();
+		}
+		double elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	return best;
+}
+
+static void benchPipeline(const char * path, long long len, int runs)
+{
+// Compare serial and pipelined cold reads against the time of the I/O alone
+	double load = coldRead(path, -1, runs);
+	report("load", load, len);
+	double serial = coldRead(path, CSV_SINGLEPASS, runs);
+	report("serial", serial, len);
+	double pipelined = coldRead(path, CSV_SINGLEPASS | CSV_PIPELINED, runs);
+	report("pipelined", pipelined, len);
+	report("I/O hidden", 0.0, 0, "%", (serial - pipelined) / load * 100.0);
+}
+
+static void benchColumn(const char * path, int runs)
+{
+// Time the conversion of a column, cell by cell or from the columnar store
+	CSVFile csv(path);
+	csv.setFlags(CSV_COLUMNAR);
+	csv.read();
+	double * values = (double *) malloc(sizeof(double) * csv.getNoRows());
+	double bestCells = 1e30, bestColumn = 1e30;
+	for (int i = 0; i < runs; i++) {
+		double start = mark();
+		for (int r = 0; r < csv.getNoRows(); r++) {
+			const char * cell = csv.getCell(r, 0);
+			values[r] = cell ? atof(cell) : 0.0;
+		}
+		double elapsed = now() - start;
+		if (elapsed < bestCells) bestCells = elapsed;
+	}
+	report("getCell+atof", bestCells, 0);
+	for (int i = 0; i < runs; i++) {
+		double start = mark();
+		csv.getColumnDouble(0, values);
+		double elapsed = now() - start;
+		if (elapsed < bestColumn) bestColumn = elapsed;
+	}
+	report("column", bestColumn, 0);
+	free(values);
+}
+
+static void benchNumbers(int noCells, int runs)
+{
+// Time number formatting and parsing, C library against typed cells
+	static const char * names[] = {"snprintf", "strtod", "setCellDouble", "getCellDouble"};
+	CSVFile csv(noCells, 1, 0);
+	double * values = (double *) malloc(sizeof(double) * noCells);
+	srand(1234);
+	for (int r = 0; r < noCells; r++)
+		values[r] = (rand() % 2000000 - 1000000) / 1000.0;
+	char cell[32];
+	for (int k = 0; k < 4; k++) {
+		double best = 1e30;
+		for (int i = 0; i < runs; i++) {
+			double start = mark();
+			if (k == 0) {
+				for (int r = 0; r < noCells; r++) {
+					snprintf(cell, sizeof(cell), "%.17g", values[r]);
+					csv.setCell(r, 0, cell);
+				}
+			}else if (k == 1) {
+				for (int r = 0; r < noCells; r++)
+					values[r] = strtod(csv.getCell(r, 0), NULL);
+			}else if (k == 2) {
+				for (int r = 0; r < noCells; r++)
+					csv.setCellDouble(r, 0, values[r]);
+			}else{
+				for (int r = 0; r < noCells; r++)
+					csv.getCellDouble(r, 0, values[r]);
+			}
+			double elapsed = now() - start;
+			if (elapsed < best) best = elapsed;
+		}
+		report(names[k], best, 0, "Mcell/s", noCells / best / 1e6);
+	}
+	free(values);
+}
+
+static void benchCells(const char * path, int runs)
+{
+// Time getCell and setCell sweeps over the whole table, by rows and by columns
+	CSVFile csv(path);
+	csv.read();
+	int noRows = csv.getNoRows();
+	int noColumns = csv.getNoColumns();
+	double noCells = (double) noRows * noColumns;
+	char cell[16];
+	for (int k = 0; k < 4; k++) {
+		double best = 1e30;
+		long long total = 0;
+		for (int i = 0; i < runs; i++) {
+			total = 0;
+			double start = mark();
+			if (k == 0) {
+				for (int r = 0; r < noRows; r++)
+					for (int c = 0; c < noColumns; c++) {
+						const char * data = csv.getCell(r, c);
+						if (data) total += strlen(data);
+					}
+			}else if (k == 1) {
+				for (int c = 0; c < noColumns; c++)
+					for (int r = 0; r < noRows; r++) {
+						const char * data = csv.getCell(r, c);
+						if (data) total += strlen(data);
+					}
+			}else{
+				for (int r = 0; r < noRows; r++)
+					for (int c = 0; c < noColumns; c++) {
+						int n = snprintf(cell, sizeof(cell), "%i", (r + c + i) % 100000);
+						if (k == 2) csv.setCell(r, c, cell);
+						else csv.setCell(noRows - 1 - r, noColumns - 1 - c, cell);
+						total += n;
+					}
+			}
+			double elapsed = now() - start;
+			if (elapsed < best) best = elapsed;
+		}
+		static const char * names[] = {"get/rows", "get/columns", "set/rows", "set/reverse"};
+		report(names[k], best, total, "Mcell/s", noCells / best / 1e6);
+	}
+}
+
+static void benchFilter(const char * name, const char * path, long long len, int flags, double max, int runs)
+{
+// Time reads keeping the rows whose first field is below max
+	double best = 1e30;
+	int noRows = 0;
+	for (int i = 0; i < runs; i++) {
+		CSVFile csv(path);
+		csv.setFlags(flags);
+		csv.setFilter(0, 0.0, max);
+		double start = mark();
+		csv.read();
+		double elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+		noRows = csv.getNoRows();
+	}
+	report(name, best, len, "rows", noRows);
+}
+
+static void benchIndex(const char * path, long long len, int runs)
+{
+// Time the index build, then reads of the last rows through the index
+	CSVFile csv(path);
+	double start = mark();
+	csv.buildIndex();
+	report("build", now() - start, len);
+	int countRows, countColumns, countComments;
+	csv.openIndex(countRows, countColumns, countComments);
+	for (int f = 0; f < 2; f++) {
+		double best = 1e30;
+		csv.setFlags(f ? CSV_MAPPED : CSV_DEFAULT);
+		for (int i = 0; i < runs; i++) {
+			start = mark();
+			csv.readRows(countRows - 100, 100);
+			double elapsed = now() - start;
+			if (elapsed < best) best = elapsed;
+		}
+		report(f ? "last100/map" : "last100", best, 0);
+	}
+	char * index = (char *) malloc(strlen(path) + 5);
+	sprintf(index, "%s.idx", path);
+	remove(index);
+	free(index);
+}
+
+static void benchSnapshot(const char * path, long long len, int runs)
+{
+// Time the snapshot save, then reloads against parsing the text
+	CSVFile csv(path);
+	csv.setFlags(CSV_SINGLEPASS);
+	csv.read();
+	double start = mark();
+	csv.saveSnapshot();
+	report("save", now() - start, len);
+	double best = 1e30;
+	for (int i = 0; i < runs; i++) {
+		start = mark();
+		csv.loadSnapshot();
+		double elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	report("load", best, len);
+	char * snapshot = (char *) malloc(strlen(path) + 6);
+	sprintf(snapshot, "%s.snap", path);
+	remove(snapshot);
+	free(snapshot);
+}
+
+static void benchClone(const char * path, int runs)
+{
+// Time a clone, the first write detaching the source, and a deep copy by reread
+	CSVFile csv(path);
+	csv.setFlags(CSV_SINGLEPASS);
+	csv.read();
+	double bestClone = 1e30, bestDetach = 1e30, bestRead = 1e30;
+	for (int i = 0; i < runs; i++) {
+		double start = mark();
+		CSVFile * clone = new CSVFile(csv);
+		double elapsed = now() - start;
+		if (elapsed < bestClone) bestClone = elapsed;
+		start = mark();
+		csv.setCell(0, 0, "detached");
+		elapsed = now() - start;
+		if (elapsed < bestDetach) bestDetach = elapsed;
+		delete clone;
+		CSVFile copy(path);
+		copy.setFlags(CSV_SINGLEPASS);
+		start = mark();
+		copy.read();
+		elapsed = now() - start;
+		if (elapsed < bestRead) bestRead = elapsed;
+	}
+	report("clone", bestClone, 0, "us", bestClone * 1e6);
+	report("first write", bestDetach, 0, "us", bestDetach * 1e6);
+	report("reread", bestRead, 0, "us", bestRead * 1e6);
+}
+
+static void readPublished(CSVFile * csv, int noReads, std::atomic<long long> * total)
+{
+// Pin a version, read one cell, unpin
+	int reader = csv->registerReader();
+	long long sum = 0;
+	for (int i = 0; i < noReads; i++) {
+		CSVFile * version = csv->beginRead(reader);
+		sum += version->getCellView(i % version->getNoRows(), i % version->getNoColumns()).length;
+		csv->endRead(reader);
+	}
+	csv->unregisterReader(reader);
+	*total += sum;
+}
+
+static void benchPublish(const char * path, int runs)
+{
+// Read scaling by thread count, while the writer keeps publishing
+	CSVFile csv(path);
+	csv.setFlags(CSV_SINGLEPASS);
+	csv.read();
+	double start = mark();
+	csv.publish();
+	double elapsed = now() - start;
+	report("publish", elapsed, 0, "us", elapsed * 1e6);
+	const int noReads = 1 << 20;
+	std::atomic<long long> total(0);
+	for (int noThreads = 1; noThreads <= 8; noThreads *= 2) {
+		double best = 1e30;
+		int noVersions = 0;
+		for (int i = 0; i < runs; i++) {
+			std::atomic<int> running(noThreads);
+			std::thread * readers = new std::thread[noThreads];
+			start = mark();
+			for (int t = 0; t < noThreads; t++)
+				readers[t] = std::thread([&]() {readPublished(&csv, noReads, &total); running--;});
+			noVersions = 0;
+			while (running.load()) {
+				csv.setCellInt64(noVersions % csv.getNoRows(), 0, noVersions);
+				csv.publish();
+				noVersions++;
+			}
+			for (int t = 0; t < noThreads; t++)
+				readers[t].join();
+			elapsed = now() - start;
+			if (elapsed < best) best = elapsed;
+			delete [] readers;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "read/%d thread%s", noThreads, noThreads > 1 ? "s" : "");
+		report(name, best, 0, "Mread/s", noThreads * (double) noReads / best / 1e6);
+	}
+}
+
+static void benchGrow(int noRows, int runs)
+{
+// Build a table row by row, then widen it column by column
+	double bestRows = 1e30, bestColumns = 1e30;
+	for (int i = 0; i < runs; i++) {
+		CSVFile csv(0, 4, 0);
+		double start = mark();
+		for (int r = 0; r < noRows; r++) {
+			csv.addRow();
+			for (int c = 0; c < 4; c++)
+				csv.setCellInt64(r, c, r + c);
+		}
+		double elapsed = now() - start;
+		if (elapsed < bestRows) bestRows = elapsed;
+		start = mark();
+		for (int c = 0; c < 12; c++)
+			csv.addColumn();
+		elapsed = now() - start;
+		if (elapsed < bestColumns) bestColumns = elapsed;
+	}
+	report("addRow", bestRows, 0, "Mrow/s", noRows / bestRows / 1e6);
+	report("addColumn x12", bestColumns, 0);
+}
+
+static bool countRow(void * user, int row, const CSVView * fields, int noFields)
+{
+	(* (long long *) user) += noFields;
+	return true;
+}
+
+static void benchStream(const char * name, const char * path, long long len, int bufferSize, int runs)
+{
+// Time row by row streaming of the file
+	double best = 1e30;
+	for (int i = 0; i < runs; i++) {
+		CSVFile csv(path);
+		long long noFields = 0;
+		double start = mark();
+		csv.stream(countRow, &noFields, bufferSize);
+		double elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	report(name, best, len);
+}
+
+static void benchScan(const char * name, const char * path, long long len, int runs)
+{
+// Time the delimiter scan alone (assess on a file kept in memory)
+	static const char * kernels[] = {"auto", "scalar", "sse2", "avx2"};
+	int countRows, countColumns, countComments, countLineChars;
+	CSVFile csv(path);
+	csv.assess(countRows, countColumns, countComments, countLineChars, true);
+	for (int k = CSV_KERNEL_SCALAR; k <= CSV_KERNEL_AVX2; k++) {
+		csv.setKernel(k);
+		if (csv.getKernel() != k) continue;
+		double best = 1e30;
+		for (int i = 0; i < runs; i++) {
+			double start = mark();
+			csv.assess(countRows, countColumns, countComments, countLineChars, true);
+			double elapsed = now() - start;
+			if (elapsed < best) best = elapsed;
+		}
+		char label[32];
+		snprintf(label, sizeof(label), "%s/%s", name, kernels[k]);
+		report(label, best, len);
+	}
+}
+
+static void benchWrite(const char * name, CSVFile & csv, int bufferSize, int flags, int runs)
+{
+// Time complete writes of the table
+	double best = 1e30;
+	csv.setWriteBuffer(bufferSize);
+	csv.setFlags(flags);
+	for (int i = 0; i < runs; i++) {
+		double start = mark();
+		csv.write();
+		double elapsed = now() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	report(name, best, fileLength(csv.getFilename()));
+}
+
+static void benchPacked(const char * name, CSVFile & csv, const char * path, long long len, int flags, int runs)
+{
+// Time compressed writes and reads of the table (rates of the plain text)
+	double bestWrite = 1e30, bestRead = 1e30;
+	csv.setFilename(path);
+	csv.setFlags(flags);
+	for (int i = 0; i < runs; i++) {
+		double start = mark();
+		csv.write();
+		double elapsed = now() - start;
+		if (elapsed < bestWrite) bestWrite = elapsed;
+	}
+	char label[32];
+	snprintf(label, sizeof(label), "%s/write", name);
+	report(label, bestWrite, len);
+	long long packedLen = fileLength(path);
+	for (int i = 0; i < runs; i++) {
+		CSVFile copy(path);
+		double start = mark();
+		copy.read();
+		double elapsed = now() - start;
+		if (elapsed < bestRead) bestRead = elapsed;
+	}
+	snprintf(label, sizeof(label), "%s/read", name);
+	report(label, bestRead, len, "ratio", packedLen ? (double) len / packedLen : 0.0);
+	remove(path);
+}
+
+/*****************************************************************************/
+static void usage()
+{
+	printf("Usage: csv-bench.exe [rows] [columns] [options]\n");
+	printf("  -w width    text cells of the given width (0: numbers)\n");
+	printf("  -c every    one comment line every n rows (0: none)\n");
+	printf("  -q percent  percentage of quoted cells\n");
+	printf("  -r percent  percentage of ragged rows\n");
+	printf("  -m          machine readable output (semicolon separated)\n");
+}
+
+int main(int argc, char * argv[])
+{
+	int noRows = 1000000;
+	int noColumns = 8;
+	int width = 0, commentEvery = 1000, quoted = 0, ragged = 0;
+	const char * path = "bench.csv";
+
+// Parse the command line
+	int noPositional = 0;
+	for (int i = 1; i < argc; i++) {
+		const char * arg = argv[i];
+		if (arg[0] != '-') {
+			if (noPositional == 0) noRows = atoi(arg);
+			else if (noPositional == 1) noColumns = atoi(arg);
+			noPositional++;
+		}else if (strcmp(arg, "-m") == 0) {
+			machine = true;
+		}else if (arg[1] && !arg[2] && strchr("wcqr", arg[1]) && i + 1 < argc) {
+			int value = atoi(argv[++i]);
+			if (arg[1] == 'w') width = value;
+			else if (arg[1] == 'c') commentEvery = value;
+			else if (arg[1] == 'q') quoted = value;
+			else ragged = value;
+		}else{
+			usage();
+			return 1;
+		}
+	}
+	if (noRows < 100 || noColumns < 1) {
+		usage();
+		return 1;
+	}
+
+	if (machine) {
+		printf("# csv-bench rows=%i columns=%i width=%i comments=%i quoted=%i ragged=%i\n",
+			noRows, noColumns, width, commentEvery, quoted, ragged);
+		printf("suite;name;ms;mb_s;value;unit;peak_kb;allocs\n");
+	}else{
+		printf("Generating %i x %i cells\n", noRows, noColumns);
+	}
+	long long len = generate(path, noRows, noColumns, width, commentEvery, quoted, ragged);
+	if (!len) {
+		printf("Could not write %s\n", path);
+		return 1;
+	}
+
+	section("read", "read");
+	benchRead("two-pass", path, len, CSV_DEFAULT, 3);
+	benchRead("single-pass", path, len, CSV_SINGLEPASS, 3);
+	benchRead("two-pass/map", path, len, CSV_MAPPED, 3);
+	benchRead("single/map", path, len, CSV_SINGLEPASS | CSV_MAPPED, 3);
+	benchRead("in-situ", path, len, CSV_SINGLEPASS | CSV_INSITU, 3);
+	benchRead("in-situ/map", path, len, CSV_SINGLEPASS | CSV_INSITU | CSV_MAPPED, 3);
+	benchRead("parallel", path, len, CSV_PARALLEL, 3);
+	benchRead("parallel/map", path, len, CSV_PARALLEL | CSV_INSITU | CSV_MAPPED, 3);
+	benchRead("columnar", path, len, CSV_SINGLEPASS | CSV_COLUMNAR, 3);
+	benchRead("lazy/map", path, len, CSV_LAZY | CSV_MAPPED, 3);
+	benchFilter("filter/100%", path, len, CSV_SINGLEPASS, RAND_MAX, 3);
+	benchFilter("filter/1%", path, len, CSV_SINGLEPASS, RAND_MAX / 100, 3);
+	benchFilter("filter/1%/2p", path, len, CSV_DEFAULT, RAND_MAX / 100, 3);
+	benchStream("stream/64k", path, len, 65536, 3);
+	benchStream("stream/1m", path, len, 1 << 20, 3);
+
+#ifdef CSV_STATS
+	if (!machine) {
+	// Where a two-pass read spends its time (make bench STATS=1)
+		CSVFile csv(path);
+		csv.read();
+		csv.dumpProfile(stdout);
+	}
+#endif
+
+	section("assess", "assess");
+	benchAssess("count", path, len, CSV_DEFAULT, false, 0, 3);
+	benchAssess("count/par", path, len, CSV_PARALLEL, false, 0, 3);
+	benchAssess("stats", path, len, CSV_DEFAULT, true, 0, 3);
+	benchAssess("stats/par", path, len, CSV_PARALLEL, true, 0, 3);
+	benchAssess("stats/1%", path, len, CSV_DEFAULT, true, len / 100, 3);
+
+	section("pipeline", "cold read pipeline");
+	benchPipeline(path, len, 3);
+
+	section("index", "index");
+	benchIndex(path, len, 3);
+
+	section("snapshot", "snapshot");
+	benchSnapshot(path, len, 3);
+
+	section("clone", "copy-on-write clone");
+	benchClone(path, 3);
+
+	section("publish", "published versions");
+	benchPublish(path, 3);
+
+	section("grow", "table growth (1M rows, one by one)");
+	benchGrow(1000000, 3);
+
+	section("cells", "getCell / setCell sweeps");
+	benchCells(path, 3);
+
+	section("column", "column conversion");
+	benchColumn(path, 3);
+
+	section("projection", "projection (3 of 64 columns)");
+	const char * widePath = "bench-wide.csv";
+	long long wideLen = generate(widePath, noRows / 8, 64, width, commentEvery, quoted, ragged);
+	int projection[3] = {0, 31, 63};
+	benchRead("all", widePath, wideLen, CSV_SINGLEPASS, 3);
+	benchRead("projected", widePath, wideLen, CSV_SINGLEPASS, 3, projection, 3);
+	benchRead("all/in-situ", widePath, wideLen, CSV_SINGLEPASS | CSV_INSITU, 3);
+	benchRead("proj/in-situ", widePath, wideLen, CSV_SINGLEPASS | CSV_INSITU, 3, projection, 3);
+	remove(widePath);
+
+	section("quoted", "quoted fields (a third of the text cells)");
+	const char * quotedPath = "bench-quoted.csv";
+	long long quotedLen = generate(quotedPath, noRows / 4, noColumns, 16, 1000, 33, 0);
+	benchRead("as text", quotedPath, quotedLen, CSV_SINGLEPASS, 3);
+	benchAssess("count/text", quotedPath, quotedLen, CSV_DEFAULT, false, 0, 3);
+	readQuote = '"';
+	benchRead("quoted", quotedPath, quotedLen, CSV_SINGLEPASS, 3);
+	benchRead("quoted/in-situ", quotedPath, quotedLen, CSV_SINGLEPASS | CSV_INSITU, 3);
+	benchRead("quoted/2p", quotedPath, quotedLen, CSV_DEFAULT, 3);
+	benchAssess("count/quoted", quotedPath, quotedLen, CSV_DEFAULT, false, 0, 3);
+	readQuote = 0;
+	remove(quotedPath);
+
+	section("numbers", "numbers");
+	benchNumbers(noRows, 3);
+
+	section("write", "write (8 small cells per row)");
+	CSVFile table(noRows, 8, 0);
+	char cell[16];
+	for (int r = 0; r < noRows; r++)
+		for (int c = 0; c < 8; c++) {
+			snprintf(cell, sizeof(cell), "%i", (r * 8 + c) % 10000);
+			table.setCell(r, c, cell);
+		}
+	table.setFilename("bench-write.csv");
+	benchWrite("fwrite", table, 0, CSV_DEFAULT, 3);
+	benchWrite("buffer/64k", table, 65536, CSV_DEFAULT, 3);
+	benchWrite("buffer/1m", table, 1 << 20, CSV_DEFAULT, 3);
+	benchWrite("direct/1m", table, 1 << 20, CSV_DIRECTIO, 3);
+	long long writtenLen = fileLength("bench-write.csv");
+	remove("bench-write.csv");
+
+#if defined(CSV_ZLIB) || defined(CSV_ZSTD)
+	section("packed", "compressed files");
+#endif
+#ifdef CSV_ZLIB
+	benchPacked("gzip", table, "bench-write.csv.gz", writtenLen, CSV_DEFAULT, 3);
+#endif
+#ifdef CSV_ZSTD
+	benchPacked("zstd", table, "bench-write.csv.zst", writtenLen, CSV_DEFAULT, 3);
+	benchPacked("zstd/mt", table, "bench-write.csv.zst", writtenLen, CSV_PARALLEL, 3);
+#endif
+
+	section("scan", "scanning kernels");
+	benchScan("numbers", path, len, 5);
+	len = generate(path, noRows / 4, noColumns, 32, 1000);
+	benchScan("text", path, len, 5);
+	len = generate(path, noRows, noColumns, 0, 2);
+	benchScan("comments", path, len, 5);
+
+	remove(path);
+	return 0;
+}
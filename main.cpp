@@ -33,9 +33,101 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <utility>
+#include <thread>
+#include <atomic>
 
 #include "CSVFile.h"
 
+#ifdef __GLIBC__
+	#include <malloc.h>
+#endif
+
+static bool sameContent(CSVFile * a, CSVFile * b)
+{
+	if (a->getNoRows() != b->getNoRows()) return false;
+	if (a->getNoColumns() != b->getNoColumns()) return false;
+	if (a->getNoComments() != b->getNoComments()) return false;
+	for (int r = 0; r < a->getNoRows(); r++)
+		for (int c = 0; c < a->getNoColumns(); c++) {
+			const char * ca = a->getCell(r, c);
+			const char * cb = b->getCell(r, c);
+			if (!ca != !cb) return false;
+			if (ca && strcmp(ca, cb)) return false;
+		}
+	for (int c = 0; c < a->getNoComments(); c++) {
+		const char * ca = a->getComment(c);
+		const char * cb = b->getComment(c);
+		if (!ca != !cb) return false;
+		if (ca && strcmp(ca, cb)) return false;
+	}
+	return true;
+}
+
+static bool sameFile(const char * pathA, const char * pathB)
+{
+	FILE * a = fopen(pathA, "rb");
+	FILE * b = fopen(pathB, "rb");
+	bool same = a && b;
+	while (same) {
+		int ca = fgetc(a);
+		int cb = fgetc(b);
+		if (ca != cb) same = false;
+		if (ca == EOF) break;
+	}
+	if (a) fclose(a);
+	if (b) fclose(b);
+	return same;
+}
+
+static long long heapInUse()
+{
+// Heap bytes in use, 0 where the C library does not report them
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 info = mallinfo2();
+	return (long long) (info.uordblks + info.hblkhd);
+#else
+	return 0;
+#endif
+}
+
+static bool countRow(void * user, int row, const CSVView * fields, int noFields)
+{
+	int * counts = (int *) user;
+	counts[0]++;
+	for (int f = 0; f < noFields; f++)
+		counts[1] += fields[f].length;
+	return true;
+}
+
+static std::atomic<int> noReads(0);
+static std::atomic<int> noTorn(0);
+static std::atomic<bool> stopReads(false);
+
+static void readVersions(CSVFile * csv)
+{
+// All cells of a version hold its number, versions never go back
+	int reader = csv->registerReader();
+	if (reader < 0) {
+		noTorn++;
+		return;
+	}
+	long long last = 0;
+	while (!stopReads.load() || !noReads.load()) {
+		CSVFile * version = csv->beginRead(reader);
+		long long first = -1, value = -1;
+		version->getCellInt64(0, 0, first);
+		for (int r = 0; r < version->getNoRows(); r++)
+			for (int c = 0; c < version->getNoColumns(); c++)
+				if (!version->getCellInt64(r, c, value) || value != first) noTorn++;
+		if (first < last || version->getNoRows() != 40) noTorn++;
+		last = first;
+		csv->endRead(reader);
+		noReads++;
+	}
+	csv->unregisterReader(reader);
+}
+
 int main(int argc, char * argv[])
 {
 	printf("Testing constructors / destructors\n");
@@ -74,11 +166,645 @@ int main(int argc, char * argv[])
 	printf("Testing read\n");
 	csv5->read();
 
+	printf("Testing single-pass read\n");
+	CSVFile * csv6 = new CSVFile("csv4.csv");
+	csv6->setFlags(CSV_SINGLEPASS);
+	csv6->read();
+	if (!sameContent(csv5, csv6)) printf("Mismatch!\n");
+	delete csv6;
+
+	printf("Testing mapped read\n");
+	CSVFile * csv7 = new CSVFile("csv4.csv");
+	csv7->setFlags(CSV_SINGLEPASS | CSV_MAPPED);
+	csv7->read(true);
+	if (!sameContent(csv5, csv7)) printf("Mismatch!\n");
+	csv7->read();
+	if (!sameContent(csv5, csv7)) printf("Mismatch!\n");
+	delete csv7;
+
+	printf("Testing in-situ read\n");
+	CSVFile * csv8 = new CSVFile("csv4.csv");
+	csv8->setFlags(CSV_INSITU | CSV_MAPPED);
+	csv8->read();
+	CSVView view = csv8->getCellView(0, 1);
+	if (view.length != 8 || strncmp(view.data, "Cell 0x1", 8)) printf("Mismatch!\n");
+	if (!sameContent(csv5, csv8)) printf("Mismatch!\n");
+	csv8->setFlags(CSV_INSITU);
+	csv8->read();
+	if (!sameContent(csv5, csv8)) printf("Mismatch!\n");
+	delete csv8;
+
+	printf("Testing scanning kernels\n");
+	CSVFile * csv9 = new CSVFile("csv4.csv");
+	for (int k = CSV_KERNEL_SCALAR; k <= CSV_KERNEL_AVX2; k++) {
+		csv9->setKernel(k);
+		csv9->read();
+		if (!sameContent(csv5, csv9)) printf("Mismatch!\n");
+	}
+	delete csv9;
+
+	printf("Testing parallel read\n");
+	CSVFile * csv10 = new CSVFile("csv4.csv");
+	csv10->setFlags(CSV_PARALLEL);
+	csv10->setThreads(4);
+	csv10->read();
+	if (!sameContent(csv5, csv10)) printf("Mismatch!\n");
+	delete csv10;
+	FILE * file47 = fopen("csv47.csv", "wb");
+	for (int l = 0; l < 120000; l++) {
+	// Lines of 32 bytes: chunks of 2 to 4 threads start on lines n / 4, n / 3, n / 2...
+		int near = 3;
+		for (int t = 2; t <= 4; t++)
+			for (int i = 1; i < t; i++)
+				if (abs(l - 120000 * i / t) < abs(near)) near = l - 120000 * i / t;
+		if (near >= -1 && near <= 1) fprintf(file47, "#comment;%08i;abcdefghijkl\r\n", l);
+		else if (near == 2) fprintf(file47, "wide;%08i;a;b;c;d;e;fghijk\r\n", l);
+		else fprintf(file47, "rows;%08i;abcdefghijklmnop\r\n", l);
+	}
+	fclose(file47);
+	CSVFile * csv47 = new CSVFile("csv47.csv");
+	csv47->read();
+	if (csv47->getNoRows() != 119985 || csv47->getNoColumns() != 8 || csv47->getNoComments() != 15) printf("Mismatch!\n");
+	CSVFile * csv48 = new CSVFile("csv47.csv");
+	for (int t = 2; t <= 5; t++) {
+		csv48->setThreads(t);
+		csv48->setFlags(t % 2 ? CSV_PARALLEL : CSV_PARALLEL | CSV_INSITU);
+		csv48->assess(countRows, countColumns, countComments, countLineChars);
+		if (countRows != 119985 || countColumns != 8 || countComments != 15) printf("Mismatch!\n");
+		if (csv48->read() || !sameContent(csv47, csv48)) printf("Mismatch!\n");
+	}
+	delete csv48;
+	delete csv47;
+
+	printf("Testing streaming\n");
+	CSVFile * csv11 = new CSVFile("csv4.csv");
+	int counts[2] = {0, 0};
+	csv11->stream(countRow, counts, 256);
+	if (counts[0] != csv5->getNoRows()) printf("Mismatch!\n");
+	char * longCell = (char *) malloc(100001);
+	memset(longCell, 'x', 100000);
+	longCell[100000] = 0;
+	CSVFile * csv12 = new CSVFile(1, 2, 0);
+	csv12->setCell(0, 0, longCell);
+	csv12->setCell(0, 1, "end");
+	csv12->setFilename("csv12.csv");
+	csv12->write();
+	counts[0] = counts[1] = 0;
+	csv12->stream(countRow, counts, 256);
+	if (counts[0] != 1 || counts[1] != 100003) printf("Mismatch!\n");
+	free(longCell);
+	delete csv12;
+	delete csv11;
+
 	printf("Testing re-write\n");
 	csv5->setFilename("csv5.csv");
 	csv5->write();
+
+	printf("Testing buffered write\n");
+	csv5->setFilename("csv5b.csv");
+	csv5->setWriteBuffer(64);
+	csv5->write();
+	if (!sameFile("csv5.csv", "csv5b.csv")) printf("Mismatch!\n");
+	csv5->setFlags(CSV_DIRECTIO);
+	csv5->setWriteBuffer(1 << 20);
+	csv5->write();
+	if (!sameFile("csv5.csv", "csv5b.csv")) printf("Mismatch!\n");
+
+	printf("Testing append\n");
+	csv5->setFlags(CSV_DEFAULT);
+	csv5->setWriteBuffer(0);
+	csv5->setFilename("csv13.csv");
+	csv5->write();
+	csv5->append();
+	CSVFile * csv13 = new CSVFile("csv13.csv");
+	csv13->read();
+	int half = csv5->getNoRows();
+	if (csv13->getNoRows() != 2 * half) printf("Mismatch!\n");
+	if (csv13->getNoComments() != 2 * csv5->getNoComments()) printf("Mismatch!\n");
+	for (int r = 0; r < csv13->getNoRows(); r++)
+		for (int c = 0; c < csv13->getNoColumns(); c++) {
+			const char * ca = csv5->getCell(r % half, c);
+			const char * cb = csv13->getCell(r, c);
+			if (!ca != !cb || (ca && strcmp(ca, cb))) printf("Mismatch!\n");
+		}
+	const char * fields[2] = {"Appended ; row", NULL};
+	if (csv13->openAppend(csv13->getNoColumns() + 1) != CSV_FORMATERROR) printf("Mismatch!\n");
+	csv13->openAppend(csv13->getNoColumns());
+	csv13->appendComment("Appended comment");
+	csv13->appendRow(fields, 2);
+	csv13->flushAppend();
+	csv13->appendRow(fields, 1);
+	csv13->closeAppend();
+	csv13->read();
+	if (csv13->getNoRows() != 2 * half + 2) printf("Mismatch!\n");
+	if (strcmp(csv13->getCell(2 * half + 1, 0), "Appended : row")) printf("Mismatch!\n");
+	if (strcmp(csv13->getComment(csv13->getNoComments() - 1), "Appended comment")) printf("Mismatch!\n");
+	delete csv13;
 	delete csv5;
 
+	printf("Testing columnar store\n");
+	CSVFile * csv14 = new CSVFile(4, 3, 0);
+	const char * numbers[4][3] = {
+		{"12", "1.5", "abc"}, {"-7", " 2e3 ", NULL},
+		{NULL, "x1", "d"}, {"9223372036854775807", "-0.25", "ef"}};
+	for (int r = 0; r < 4; r++)
+		for (int c = 0; c < 3; c++)
+			csv14->setCell(r, c, numbers[r][c]);
+	csv14->setFilename("csv14.csv");
+	csv14->write();
+	long long ints[4];
+	double doubles[4];
+	for (int f = 0; f < 2; f++) {
+		csv14->setFlags(f ? CSV_INSITU | CSV_MAPPED : CSV_COLUMNAR);
+		csv14->read();
+		CSVColumnView text = csv14->getColumn(2);
+		if (!f && (!text.bytes || strcmp(&text.bytes[text.offsets[3]], "ef"))) printf("Mismatch!\n");
+		if (!f && text.offsets[2] - text.offsets[1] != 1) printf("Mismatch!\n");
+		if (f && text.bytes) printf("Mismatch!\n");
+		if (csv14->getColumnInt64(0, ints, -1) != 3) printf("Mismatch!\n");
+		if (ints[0] != 12 || ints[1] != -7 || ints[2] != -1 || ints[3] != 9223372036854775807LL) printf("Mismatch!\n");
+		if (csv14->getColumnDouble(1, doubles) != 3) printf("Mismatch!\n");
+		if (doubles[0] != 1.5 || doubles[1] != 2000.0 || doubles[2] != 0.0 || doubles[3] != -0.25) printf("Mismatch!\n");
+	}
+	delete csv14;
+
+	printf("Testing typed cells\n");
+	CSVFile * csv15 = new CSVFile(1, 8, 0);
+	double reals[8] = {0.1, -0.25, 123456.789, 1e300, 0.30000000000000004, 3.0, 5e-324, -1.5e-5};
+	const char * texts[8] = {"0.1", "-0.25", "123456.789", "1e+300", "0.30000000000000004", "3", "5e-324", "-1.5e-05"};
+	for (int c = 0; c < 8; c++) {
+		double value = 0.0;
+		csv15->setCellDouble(0, c, reals[c]);
+		if (strcmp(csv15->getCell(0, c), texts[c])) printf("Mismatch!\n");
+		if (!csv15->getCellDouble(0, c, value) || value != reals[c]) printf("Mismatch!\n");
+	}
+	long long integer = 0;
+	csv15->setCellInt64(0, 0, -9223372036854775807LL - 1);
+	if (!csv15->getCellInt64(0, 0, integer) || integer != -9223372036854775807LL - 1) printf("Mismatch!\n");
+	if (csv15->getCellInt64(0, 1, integer)) printf("Mismatch!\n");
+	delete csv15;
+
+	printf("Testing projection\n");
+	FILE * file16 = fopen("csv16.csv", "wb");
+	fputs("#Header\r\nid;name;value;extra\r\n1;one;1.5;x\r\n2;two\r\n;;3.5;;\r\n", file16);
+	fclose(file16);
+	CSVFile * csv16 = new CSVFile("csv16.csv");
+	csv16->read();
+	CSVFile * csv17 = new CSVFile("csv16.csv");
+	int projected[2] = {2, 0};
+	const char * names[2] = {"value", "id"};
+	int modes[3] = {CSV_DEFAULT, CSV_SINGLEPASS | CSV_INSITU, CSV_PARALLEL};
+	for (int m = 0; m < 6; m++) {
+		csv17->setFlags(modes[m % 3]);
+		if (m < 3) csv17->setProjection(projected, 2);
+		else csv17->setProjectionNames(names, 2);
+		csv17->read();
+		if (csv17->getNoRows() != csv16->getNoRows() || csv17->getNoColumns() != 2) printf("Mismatch!\n");
+		for (int r = 0; r < csv17->getNoRows(); r++)
+			for (int c = 0; c < 2; c++) {
+				const char * ca = csv16->getCell(r, projected[c]);
+				const char * cb = csv17->getCell(r, c);
+				if (!ca != !cb || (ca && strcmp(ca, cb))) printf("Mismatch!\n");
+			}
+	}
+	csv17->assess(countRows, countColumns, countComments, countLineChars);
+	if (countColumns != 2) printf("Mismatch!\n");
+	names[1] = "missing";
+	csv17->setProjectionNames(names, 2);
+	if (csv17->read() != CSV_FORMATERROR) printf("Mismatch!\n");
+	delete csv17;
+
+	printf("Testing filter\n");
+	CSVFile * csv18 = new CSVFile("csv16.csv");
+	for (int m = 0; m < 3; m++) {
+		csv18->setFlags(modes[m]);
+		csv18->setFilter(1, "tw", true);
+		csv18->read();
+		if (csv18->getNoRows() != 1 || strcmp(csv18->getCell(0, 0), "2")) printf("Mismatch!\n");
+		csv18->setFilter(2, 2.0, 10.0);
+		csv18->setProjection(projected, 2);
+		csv18->read();
+		if (csv18->getNoRows() != 1 || strcmp(csv18->getCell(0, 0), "3.5")) printf("Mismatch!\n");
+		csv18->clearProjection();
+		csv18->setFilter(0, "");
+		csv18->read();
+		if (csv18->getNoRows() != 1 || csv18->getCell(0, 0)) printf("Mismatch!\n");
+	}
+	csv18->clearFilter();
+	csv18->read();
+	if (!sameContent(csv16, csv18)) printf("Mismatch!\n");
+	delete csv18;
+	delete csv16;
+
+	printf("Testing index\n");
+	FILE * file19 = fopen("csv19.csv", "wb");
+	for (int r = 0; r < 100; r++) {
+		if (r % 10 == 0) fprintf(file19, "#Rows from %i\r\n", r);
+		fprintf(file19, "row;%i;%s\r\n", r, r % 3 ? "x" : "");
+	}
+	fclose(file19);
+	remove("csv19.csv.idx");
+	CSVFile * csv19 = new CSVFile("csv19.csv");
+	csv19->read();
+	CSVFile * csv20 = new CSVFile("csv19.csv");
+	csv20->openIndex(countRows, countColumns, countComments);
+	if (countRows != 100 || countColumns != 3 || countComments != 10) printf("Mismatch!\n");
+	for (int f = 0; f < 2; f++) {
+		csv20->setFlags(f ? CSV_MAPPED | CSV_INSITU : CSV_DEFAULT);
+		csv20->readRows(37, 5);
+		if (csv20->getNoRows() != 5 || csv20->getNoColumns() != 3 || csv20->getNoComments() != 1) printf("Mismatch!\n");
+		for (int r = 0; r < 5; r++)
+			for (int c = 0; c < 3; c++) {
+				const char * ca = csv19->getCell(37 + r, c);
+				const char * cb = csv20->getCell(r, c);
+				if (!ca != !cb || (ca && strcmp(ca, cb))) printf("Mismatch!\n");
+			}
+		if (strcmp(csv20->getComment(0), "Rows from 40")) printf("Mismatch!\n");
+	}
+	csv20->readRows(98, 10);
+	if (csv20->getNoRows() != 2 || strcmp(csv20->getCell(1, 1), "99")) printf("Mismatch!\n");
+	const char * extra[3] = {"row", "100", "y"};
+	csv19->openAppend(3);
+	csv19->appendRow(extra, 3);
+	csv19->closeAppend();
+	csv20->readRows(100, 1);
+	if (csv20->getNoRows() != 1 || strcmp(csv20->getCell(0, 1), "100")) printf("Mismatch!\n");
+	delete csv20;
+	FILE * file42 = fopen("csv42.csv", "wb");
+	fputs("a;1\r\nb;2\r\n", file42);
+	fclose(file42);
+	CSVFile * csv42 = new CSVFile("csv42.csv");
+	csv42->read(true);
+	file42 = fopen("csv42.csv", "wb");
+	fputs("a;1\r\nb;2\r\n#More\r\nc;3\r\n", file42);
+	fclose(file42);
+	if (csv42->buildIndex()) printf("Mismatch!\n");
+	csv42->openIndex(countRows, countColumns, countComments);
+	if (countRows != 3 || countComments != 1) printf("Mismatch!\n");
+	csv42->readRows(2, 1);
+	if (csv42->getNoRows() != 1 || strcmp(csv42->getCell(0, 0), "c")) printf("Mismatch!\n");
+	const char * names42[2] = {"1", "a"};
+	csv42->setProjectionNames(names42, 2);
+	if (csv42->readRows(2, 1) || csv42->getNoColumns() != 2) printf("Mismatch!\n");
+	if (!csv42->getCell(0, 1) || strcmp(csv42->getCell(0, 0), "3") || strcmp(csv42->getCell(0, 1), "c")) printf("Mismatch!\n");
+	delete csv42;
+	CSVFile * csv50 = new CSVFile("csv42.csv");
+	csv50->setProjectionNames(names42, 2);
+	if (csv50->readRows(1, 1) || !csv50->getCell(0, 1) || strcmp(csv50->getCell(0, 0), "2") || strcmp(csv50->getCell(0, 1), "b")) printf("Mismatch!\n");
+	delete csv50;
+
+	printf("Testing lazy rows\n");
+	csv19->read();
+	CSVFile * csv21 = new CSVFile("csv19.csv");
+	csv21->setFlags(CSV_LAZY | CSV_MAPPED);
+	csv21->setLazyCache(4);
+	csv21->read();
+	if (!sameContent(csv19, csv21)) printf("Mismatch!\n");
+	for (int r = csv21->getNoRows() - 1; r >= 0; r -= 7)
+		for (int c = 0; c < 3; c++) {
+			const char * ca = csv19->getCell(r, c);
+			const char * cb = csv21->getCell(r, c);
+			if (!ca != !cb || (ca && strcmp(ca, cb))) printf("Mismatch!\n");
+		}
+	csv21->setFilename("csv21.csv");
+	csv21->write();
+	csv19->setFilename("csv19b.csv");
+	csv19->write();
+	if (!sameFile("csv19b.csv", "csv21.csv")) printf("Mismatch!\n");
+	csv21->setFilename("csv19.csv");
+	csv21->setFilter(2, "x");
+	csv21->setProjection(projected + 1, 1);
+	csv21->read();
+	if (csv21->getNoRows() != 66 || csv21->getNoColumns() != 1 || strcmp(csv21->getCell(65, 0), "row")) printf("Mismatch!\n");
+	delete csv21;
+	delete csv19;
+
+	printf("Testing statistics\n");
+	FILE * file22 = fopen("csv22.csv", "wb");
+	fputs("#Stats\r\nab;c;def\r\n \t\r\n1;;\r\nxyz\r\n", file22);
+	fclose(file22);
+	CSVFile * csv22 = new CSVFile("csv22.csv");
+	CSVStats stats;
+	for (int m = 0; m < 3; m++) {
+		csv22->setFlags(modes[m]);
+		csv22->assess(countRows, countColumns, countComments, countLineChars);
+		if (countRows != 3 || countColumns != 3 || countComments != 1) printf("Mismatch!\n");
+		csv22->assess(stats);
+		if (stats.noRows != 3 || stats.noColumns != 3 || stats.noComments != 1 || stats.noLineChars != countLineChars) printf("Mismatch!\n");
+		if (stats.noRaggedRows != 1 || stats.noEmptyCells != 4 || stats.sampled) printf("Mismatch!\n");
+		if (stats.columnWidths[0] != 3 || stats.columnWidths[1] != 1 || stats.columnWidths[2] != 3) printf("Mismatch!\n");
+		csv22->read();
+		if (csv22->getNoRows() != 3) printf("Mismatch!\n");
+	}
+	csv22->setFilename("csv19.csv");
+	csv22->assess(stats, 400);
+	if (!stats.sampled || stats.noRows < 80 || stats.noRows > 120 || stats.noColumns != 3) printf("Mismatch!\n");
+	delete csv22;
+
+	printf("Testing pipelined read\n");
+	const char * pipelined[3] = {"csv5.csv", "csv16.csv", "csv19.csv"};
+	for (int f = 0; f < 3; f++) {
+		CSVFile * csv23 = new CSVFile(pipelined[f]);
+		csv23->read();
+		CSVFile * csv24 = new CSVFile(pipelined[f]);
+		csv24->setPipelineBlock(7);
+		for (int m = 0; m < 2; m++) {
+			csv24->setFlags(m ? CSV_PIPELINED | CSV_INSITU : CSV_PIPELINED);
+			if (csv24->read() || !sameContent(csv23, csv24)) printf("Mismatch!\n");
+		}
+		delete csv24;
+		delete csv23;
+	}
+
+	printf("Testing compressed files\n");
+	const char * packedPaths[2] = {NULL, NULL};
+#ifdef CSV_ZLIB
+	packedPaths[0] = "csv25.csv.gz";
+#endif
+#ifdef CSV_ZSTD
+	packedPaths[1] = "csv25.csv.zst";
+#endif
+	CSVFile * csv25 = new CSVFile("csv19.csv");
+	csv25->read();
+	for (int p = 0; p < 2; p++) {
+		if (!packedPaths[p]) continue;
+		csv25->setFilename(packedPaths[p]);
+		if (csv25->write()) printf("Mismatch!\n");
+		CSVFile * csv26 = new CSVFile(packedPaths[p]);
+		for (int m = 0; m < 3; m++) {
+			csv26->setFlags(modes[m]);
+			if (csv26->read() || !sameContent(csv25, csv26)) printf("Mismatch!\n");
+		}
+		csv26->assess(countRows, countColumns, countComments, countLineChars);
+		if (countRows != csv25->getNoRows() || countComments != csv25->getNoComments()) printf("Mismatch!\n");
+		const char * lastRow[3] = {"row", "100", "x"};
+		csv26->openAppend(3);
+		csv26->appendRow(lastRow, 3);
+		if (csv26->closeAppend()) printf("Mismatch!\n");
+		csv26->read();
+		countRows = csv26->getNoRows();
+		if (countRows != csv25->getNoRows() + 1 || strcmp(csv26->getCell(countRows - 1, 1), "100")) printf("Mismatch!\n");
+		delete csv26;
+	}
+	delete csv25;
+
+	printf("Testing snapshot\n");
+	remove("csv19.csv.snap");
+	CSVFile * csv27 = new CSVFile("csv19.csv");
+	csv27->read();
+	CSVFile * csv28 = new CSVFile("csv19.csv");
+	if (csv28->loadSnapshot() != CSV_FILEERROR) printf("Mismatch!\n");
+	csv28->setFlags(CSV_SNAPSHOT);
+	csv28->read();
+	if (csv28->loadSnapshot() || !sameContent(csv27, csv28)) printf("Mismatch!\n");
+	csv28->setCell(0, 1, "changed");
+	if (strcmp(csv28->getCell(0, 1), "changed")) printf("Mismatch!\n");
+	const char * newRow[3] = {"row", "101", "z"};
+	csv27->openAppend(3);
+	csv27->appendRow(newRow, 3);
+	csv27->closeAppend();
+	csv27->read();
+	if (csv28->loadSnapshot() != CSV_FORMATERROR) printf("Mismatch!\n");
+	csv28->read();
+	if (!sameContent(csv27, csv28) || csv28->loadSnapshot() || !sameContent(csv27, csv28)) printf("Mismatch!\n");
+	delete csv28;
+	delete csv27;
+	remove("csv42.csv.snap");
+	CSVFile * csv43 = new CSVFile("csv42.csv");
+	csv43->setFlags(CSV_SNAPSHOT);
+	csv43->read(true);
+	file42 = fopen("csv42.csv", "wb");
+	fputs("a;1\r\nb;2\r\n#More\r\nc;3\r\nd;4\r\n", file42);
+	fclose(file42);
+	csv43->read();
+	CSVFile * csv44 = new CSVFile("csv42.csv");
+	csv44->setFlags(CSV_SNAPSHOT);
+	csv44->read();
+	if (csv43->getNoRows() != 3 || csv44->getNoRows() != 4 || csv44->loadSnapshot()) printf("Mismatch!\n");
+	FILE * snap44 = fopen("csv42.csv.snap", "r+b");
+	fseek(snap44, -1, SEEK_END);
+	fputc('x', snap44);
+	fclose(snap44);
+	if (csv44->loadSnapshot() != CSV_FORMATERROR) printf("Mismatch!\n");
+// Restore the terminator, then point the first cell far past the strings
+	snap44 = fopen("csv42.csv.snap", "r+b");
+	fseek(snap44, -1, SEEK_END);
+	fputc(0, snap44);
+	long long snapLen = ftell(snap44);
+	fflush(snap44);
+	if (csv44->loadSnapshot()) printf("Mismatch!\n");
+	long long farOffset = 0x7fffffffffffffffLL;
+	fseek(snap44, snapLen - 21 - 9 * 12, SEEK_SET);
+	fwrite(&farOffset, sizeof(long long), 1, snap44);
+	fclose(snap44);
+	if (csv44->loadSnapshot() != CSV_FORMATERROR) printf("Mismatch!\n");
+	delete csv44;
+	delete csv43;
+
+	printf("Testing quoted fields\n");
+	const char * quotedCells[8] = {"plain", "a;b", "say \"hi\"", "two\r\nlines", "#text", "\"", " ", "x"};
+	CSVFile * csv29 = new CSVFile(3, 3, 1);
+	csv29->setQuote('"');
+	for (int i = 0; i < 8; i++) csv29->setCell(i / 3, i % 3, quotedCells[i]);
+	csv29->setComment(0, "Quoted \"fields\"");
+	csv29->setFilename("csv29.csv");
+	if (csv29->write()) printf("Mismatch!\n");
+	CSVFile * csv30 = new CSVFile("csv29.csv");
+	csv30->setQuote('"');
+	for (int m = 0; m < 4; m++) {
+		csv30->setFlags(m < 3 ? modes[m] : CSV_LAZY | CSV_MAPPED);
+		if (csv30->read() || !sameContent(csv29, csv30)) printf("Mismatch!\n");
+	}
+	csv30->setQuote(0);
+	csv30->setFlags(CSV_DEFAULT);
+	csv30->read();
+	if (csv30->getNoRows() != 4 || strcmp(csv30->getCell(0, 1), "\"a")) printf("Mismatch!\n");
+	delete csv30;
+	delete csv29;
+	CSVFile * csv31 = new CSVFile("csv19.csv");
+	csv31->read();
+	CSVFile * csv32 = new CSVFile("csv19.csv");
+	csv32->setQuote('"');
+	csv32->read();
+	if (!sameContent(csv31, csv32)) printf("Mismatch!\n");
+	delete csv32;
+	delete csv31;
+	CSVFile * csv33 = new CSVFile(3, 1, 0);
+	csv33->setQuote('"');
+	csv33->setCell(0, 0, " ");
+	csv33->setCell(2, 0, "z");
+	csv33->setFilename("csv33.csv");
+	csv33->write();
+	csv33->read();
+	if (csv33->getNoRows() != 3 || strcmp(csv33->getCell(0, 0), " ") || csv33->getCell(1, 0)) printf("Mismatch!\n");
+	delete csv33;
+	const char * quotedLines[4] = {"row;\"a\r\nb\";1\r\n", "#\"comment;\r\n", "x;\"y;\"\"z\"\"\";2\r\n", "\"multi"};
+	FILE * file45 = fopen("csv45.csv", "wb");
+	fputs("first\r\n", file45);
+	for (int l = 0; l < 239993; l++) {
+	// Most line ends of the file are quoted
+		fputs(quotedLines[l % 4], file45);
+		for (int k = 0; l % 4 == 3 && k < 24; k++) fputs("\r\n", file45);
+		if (l % 4 == 3) fputs("line\";3\r\n", file45);
+	}
+	fclose(file45);
+	CSVFile * csv45 = new CSVFile("csv45.csv");
+	csv45->setQuote('"');
+	csv45->read();
+	if (csv45->getNoRows() != 179996 || csv45->getNoComments() != 59998) printf("Mismatch!\n");
+	CSVFile * csv46 = new CSVFile("csv45.csv");
+	csv46->setQuote('"');
+	csv46->setPipelineBlock(100000);
+	for (int t = 2; t < 6; t++) {
+		csv46->setThreads(t);
+		csv46->setFlags(t % 2 ? CSV_PARALLEL : CSV_PARALLEL | CSV_INSITU);
+		if (csv46->read() || !sameContent(csv45, csv46)) printf("Mismatch!\n");
+	}
+	csv46->setFlags(CSV_PIPELINED);
+	if (csv46->read() || !sameContent(csv45, csv46)) printf("Mismatch!\n");
+	delete csv46;
+	delete csv45;
+
+	printf("Testing clones\n");
+	CSVFile * csv34 = new CSVFile("csv19.csv");
+	csv34->read();
+	CSVFile * csv35 = new CSVFile("csv19.csv");
+	csv35->setFlags(CSV_MAPPED | CSV_INSITU);
+	csv35->read();
+	CSVFile clone(*csv35);
+	if (!sameContent(csv34, &clone)) printf("Mismatch!\n");
+	csv35->setCell(0, 1, "changed");
+	csv35->setComment(0, "changed");
+	if (strcmp(csv35->getCell(0, 1), "changed") || !sameContent(csv34, &clone)) printf("Mismatch!\n");
+	CSVFile second(clone);
+	second.setCell(1, 1, "changed");
+	csv35->read();
+	delete csv35;
+	if (!sameContent(csv34, &clone) || !strcmp(second.getCell(0, 1), "changed")) printf("Mismatch!\n");
+	CSVFile moved(std::move(clone));
+	if (clone.getNoRows() || !sameContent(csv34, &moved)) printf("Mismatch!\n");
+	clone = second;
+	second = std::move(moved);
+	if (strcmp(clone.getCell(1, 1), "changed") || !sameContent(csv34, &second)) printf("Mismatch!\n");
+	CSVFile * csv36 = new CSVFile("csv19.csv");
+	csv36->setFlags(CSV_LAZY);
+	csv36->read();
+	CSVFile lazyClone(*csv36);
+	delete csv36;
+	if (!sameContent(csv34, &lazyClone)) printf("Mismatch!\n");
+	CSVFile * csv51 = new CSVFile("csv19.csv");
+	csv51->setFlags(CSV_MAPPED | CSV_INSITU);
+	csv51->read();
+	const CSVFile & shared51 = *csv51;
+	CSVFile * clones51[4];
+	std::thread cloners[4];
+	for (int t = 0; t < 4; t++)
+		cloners[t] = std::thread([&, t]() {clones51[t] = new CSVFile(shared51);});
+	for (int t = 0; t < 4; t++) cloners[t].join();
+	delete csv51;
+	for (int t = 0; t < 4; t++) {
+		if (clones51[t]->getCloneError() || !sameContent(csv34, clones51[t])) printf("Mismatch!\n");
+		delete clones51[t];
+	}
+	CSVFile * csv40 = new CSVFile("csv19.csv");
+	csv40->setFlags(CSV_INSITU);
+	csv40->read();
+	char text[1024];
+	memset(text, 'x', 1023);
+	text[1023] = 0;
+	CSVFile * lastClone = NULL;
+	long long heap = 0;
+	for (int v = 0; v < 400; v++) {
+		csv40->setCell(v % 100, 2, text);
+		CSVFile * next = new CSVFile(*csv40);
+		delete lastClone;
+		lastClone = next;
+		if (v == 50) heap = heapInUse();
+	}
+	if (heapInUse() > heap + (4 << 20) || !sameContent(csv40, lastClone)) printf("Mismatch!\n");
+	for (int r = 0; r < 100; r++)
+		if (strcmp(lastClone->getCell(r, 1), csv34->getCell(r, 1)) || strcmp(lastClone->getCell(r, 2), text)) printf("Mismatch!\n");
+	delete lastClone;
+	delete csv40;
+	delete csv34;
+
+	printf("Testing published versions\n");
+	CSVFile * csv37 = new CSVFile(40, 4, 0);
+	if (csv37->registerReader() != -1) printf("Mismatch!\n");
+	for (int i = 0; i < 160; i++) csv37->setCellInt64(i / 4, i % 4, 0);
+	csv37->publish();
+	std::thread readers[4];
+	for (int t = 0; t < 4; t++) readers[t] = std::thread(readVersions, csv37);
+	for (int v = 1; v <= 500; v++) {
+		for (int i = 0; i < 160; i++) csv37->setCellInt64(i / 4, i % 4, v);
+		if (csv37->publish()) printf("Mismatch!\n");
+		if (!(v % 50)) std::this_thread::yield();
+	}
+	stopReads = true;
+	for (int t = 0; t < 4; t++) readers[t].join();
+	if (noTorn.load()) printf("Mismatch!\n");
+	delete csv37;
+	CSVFile * csv41 = new CSVFile(40, 4, 0);
+	csv41->publish();
+	int reader = csv41->registerReader();
+	for (int v = 1; v <= 1000; v++) {
+		for (int r = 0; r < 40; r++) csv41->setCell(r, v % 4, text);
+		if (v > 4 && !(v % 10)) {
+			CSVFile * version = csv41->beginRead(reader);
+			if (strcmp(version->getCell(39, v % 4), text)) printf("Mismatch!\n");
+			csv41->endRead(reader);
+		}
+		if (csv41->publish()) printf("Mismatch!\n");
+		if (v == 100) heap = heapInUse();
+	}
+	if (heapInUse() > heap + (8 << 20)) printf("Mismatch!\n");
+	csv41->unregisterReader(reader);
+	delete csv41;
+
+	printf("Testing table growth\n");
+	CSVFile * csv38 = new CSVFile(2, 2, 0);
+	csv38->setCell(1, 1, "keep");
+	CSVFile grown(*csv38);
+	for (int r = 0; r < 1000; r++) {
+		if (csv38->addRow()) printf("Mismatch!\n");
+		csv38->setCellInt64(r + 2, 0, r);
+	}
+	for (int c = 0; c < 20; c++)
+		if (csv38->addColumn()) printf("Mismatch!\n");
+	long long value = 0;
+	if (csv38->getNoRows() != 1002 || csv38->getNoColumns() != 22) printf("Mismatch!\n");
+	if (strcmp(csv38->getCell(1, 1), "keep") || csv38->getCell(1001, 21)) printf("Mismatch!\n");
+	if (!csv38->getCellInt64(501, 0, value) || value != 499) printf("Mismatch!\n");
+	if (grown.getNoRows() != 2 || grown.getNoColumns() != 2 || strcmp(grown.getCell(1, 1), "keep")) printf("Mismatch!\n");
+	delete csv38;
+	FILE * file49 = fopen("csv49.csv", "wb");
+	for (int r = 0; r <= 100000; r++) fprintf(file49, ";;;;;;;;\n");
+	fclose(file49);
+	heap = heapInUse();
+	CSVFile * csv49 = new CSVFile("csv49.csv");
+	if (csv49->read() || csv49->getNoRows() != 100001 || csv49->getNoColumns() != 9) printf("Mismatch!\n");
+// The known size is allocated exactly: 14.4 MB, where doubling would take 33.5 MB
+	if (heapInUse() > heap + (20 << 20)) printf("Mismatch!\n");
+	delete csv49;
+
+	printf("Testing profile\n");
+	CSVFile * csv39 = new CSVFile("csv19.csv");
+	csv39->read();
+	csv39->setFilename("csv39.csv");
+	csv39->write();
+	CSVProfile profile = csv39->getProfile();
+	if (profile.noRows != csv39->getNoRows() || profile.noComments != csv39->getNoComments()) printf("Mismatch!\n");
+#ifdef CSV_STATS
+	if (profile.loadBytes <= 0 || profile.parseBytes != profile.loadBytes || profile.writeBytes <= 0) printf("Mismatch!\n");
+	if (!profile.noAllocations || profile.peakBuffer != profile.loadBytes || profile.parseTime <= 0.0) printf("Mismatch!\n");
+#endif
+	FILE * json = fopen("csv39.json", "wb");
+	if (csv39->dumpProfile(json)) printf("Mismatch!\n");
+	fclose(json);
+	csv39->resetProfile();
+	if (csv39->getProfile().loadBytes) printf("Mismatch!\n");
+	delete csv39;
+
 	printf("End of tests\n");
 	return 0;
 }